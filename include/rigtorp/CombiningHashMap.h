@@ -0,0 +1,150 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+CombiningHashMap
+
+A HashMap protected by a mutex where writers combine updates in a per thread
+buffer before applying them to the shared map. Updates to hot keys are
+combined in the buffer, so each flush takes the lock once and applies at
+most one update per distinct key.
+
+Each thread creates its own buffer:
+
+  CombiningHashMap<uint64_t, uint64_t> hm(1024, 0);
+  CombiningHashMap<uint64_t, uint64_t>::buffer buf(hm);
+  buf.update(key, 1); // hm[key] = Combine()(hm[key], 1) on flush
+
+Updates to a key are combined in the buffer before being combined with the
+value in the map, so Combine must be associative. Keys not in the map are
+combined with T(), like operator[].
+
+The buffer is flushed every flush_threshold updates, on flush() and when
+destroyed. Readers only see flushed updates. A flush either applies all
+buffered updates or, if growing the map throws, none of them. Buffered
+updates that fail to flush when the buffer is destroyed are dropped, call
+flush() before destroying a buffer to handle errors.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <rigtorp/HashMap.h>
+
+namespace rigtorp {
+
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<void>,
+          typename Allocator = std::allocator<std::pair<Key, T>>,
+          typename Combine = std::plus<T>>
+class CombiningHashMap {
+public:
+  using key_type = Key;
+  using mapped_type = T;
+  using size_type = std::size_t;
+  using map_type = HashMap<Key, T, Hash, KeyEqual, Allocator>;
+
+  // Per thread update buffer, not thread safe
+  class buffer {
+  public:
+    explicit buffer(CombiningHashMap &map)
+        : map_(map), local_(2 * map.flush_threshold_, map.empty_key_) {}
+
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    ~buffer() {
+      try {
+        flush();
+      } catch (...) {
+      }
+    }
+
+    void update(const key_type &key, const mapped_type &delta) {
+      auto res = local_.emplace(key, delta);
+      if (!res.second) {
+        res.first->second = Combine()(res.first->second, delta);
+      }
+      if (++updates_ >= map_.flush_threshold_) {
+        flush();
+      }
+    }
+
+    // Applies all buffered updates to the shared map
+    void flush() {
+      if (local_.empty()) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(map_.mutex_);
+        // Only reserving allocates, so that either all or no updates are
+        // applied if it throws
+        map_.map_.reserve(map_.map_.size() + local_.size());
+        for (const auto &e : local_) {
+          auto it = map_.map_.find(e.first);
+          if (it != map_.map_.end()) {
+            it->second = Combine()(it->second, e.second);
+          } else {
+            map_.map_.emplace(e.first, Combine()(mapped_type(), e.second));
+          }
+        }
+      }
+      local_.clear();
+      updates_ = 0;
+    }
+
+    // Number of distinct keys buffered
+    size_type size() const noexcept { return local_.size(); }
+
+  private:
+    CombiningHashMap &map_;
+    map_type local_;
+    size_type updates_ = 0;
+  };
+
+  CombiningHashMap(size_type bucket_count, key_type empty_key,
+                   size_type flush_threshold = 64)
+      : empty_key_(empty_key), flush_threshold_(flush_threshold),
+        map_(bucket_count, empty_key) {
+    assert(flush_threshold > 0 && "flush threshold must be non-zero");
+  }
+
+  size_type flush_threshold() const noexcept { return flush_threshold_; }
+
+  // Lookup of flushed updates
+  bool find(const key_type &key, mapped_type &value) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+      return false;
+    }
+    value = it->second;
+    return true;
+  }
+
+  size_type size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return map_.size();
+  }
+
+  // Calls f(const value_type &) for each item while holding the lock
+  template <typename F> void for_each(F f) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &v : map_) {
+      f(v);
+    }
+  }
+
+private:
+  key_type empty_key_;
+  size_type flush_threshold_;
+  mutable std::mutex mutex_;
+  map_type map_;
+};
+} // namespace rigtorp
@@ -0,0 +1,572 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+ConcurrentHashMap
+
+A lock-free hash map for 64 bit integer keys and values. Uses open addressing
+with linear probing like HashMap.
+
+Each bucket holds an atomic key and an atomic value. A key is inserted by
+compare-and-swap of the empty key to the key, after which the bucket belongs
+to that key for the lifetime of the table. The value is then published by
+compare-and-swap on the value. Erase replaces the value with a tombstone and
+inserting the key again reuses the bucket.
+
+Since keys are never removed from a table, tombstones are cleaned up by
+migrating to a new table. A migration is started when half of the buckets
+have been claimed. The new table has the same size if at most a quarter of
+the buckets hold live values, otherwise it's grown. All threads accessing
+the map help migrate chunks of buckets. A migrated bucket, including empty
+buckets, has its value replaced by a moved marker, telling threads to
+continue in the new table. New keys are still claimed in the old table
+during a migration, so a key is only ever reached through one bucket per
+table. If the old table fills up, inserts of new keys wait for the
+migration to finish before claiming buckets in the new table. The new table
+is never smaller than the old one and only receives keys of the old table
+while migrating, so it can't fill up before the migration is done.
+
+Requirements:
+  - The empty key is reserved and can't be inserted.
+  - Values greater than max_value are reserved.
+
+Migrated tables are freed using epoch based reclamation. Each operation
+registers in the current epoch on entry and leaves it on exit. When the
+migration from a table finishes it's retired in the current epoch, and it's
+freed once the epoch has advanced twice. The epoch only advances when no
+operation is registered in the previous epoch, so by then every operation
+that could have seen the retired table has finished. Threads register in
+one of a fixed number of counters per map, so that threads rarely share a
+counter. A thread that stalls in the middle of an operation delays freeing
+tables retired after it started.
+
+Operations are lock-free, except that threads wait for a migration to
+finish when resizing a table that is still being migrated into or when
+inserting a new key into a full table, and wait for the thread allocating
+the next table.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+
+namespace rigtorp {
+
+template <typename Hash = std::hash<uint64_t>> class ConcurrentHashMap {
+public:
+  using key_type = uint64_t;
+  using mapped_type = uint64_t;
+  using size_type = std::size_t;
+  using hasher = Hash;
+
+  static constexpr mapped_type max_value = ~mapped_type(0) - 3;
+
+  ConcurrentHashMap(size_type bucket_count, key_type empty_key)
+      : empty_key_(empty_key) {
+    size_t pow2 = min_bucket_count;
+    while (pow2 < bucket_count) {
+      pow2 <<= 1;
+    }
+    oldest_ = new table(pow2, empty_key_);
+    root_.store(oldest_, std::memory_order_relaxed);
+    for (auto &s : stripes_) {
+      for (auto &active : s.active) {
+        active.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+  ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+  ~ConcurrentHashMap() {
+    while (oldest_ != nullptr) {
+      table *next = oldest_->next.load(std::memory_order_relaxed);
+      delete oldest_;
+      oldest_ = next;
+    }
+  }
+
+  // Capacity
+
+  // Number of live entries, only exact when no operations are in progress
+  size_type size() const noexcept {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  // Modifiers
+
+  // Inserts value if key is not present, returns true if inserted
+  bool insert(key_type key, mapped_type value) {
+    assert(key != empty_key_ && "empty key shouldn't be used");
+    assert(value <= max_value && "reserved value shouldn't be used");
+    const epoch_guard guard(*this);
+    table *t = root_.load(std::memory_order_seq_cst);
+    for (;;) {
+      help_migrate(t);
+      slot *s = claim(t, key);
+      if (s == nullptr) {
+        t = claim_next(t);
+        continue;
+      }
+      start_migration(t);
+      mapped_type v = s->value.load(std::memory_order_acquire);
+      while (v != moved_value) {
+        if (v != null_value && v != tombstone_value) {
+          return false;
+        }
+        if (s->value.compare_exchange_weak(v, value,
+                                           std::memory_order_acq_rel)) {
+          size_.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      t = t->next.load(std::memory_order_acquire);
+    }
+  }
+
+  // Inserts value or assigns it if key is present, returns true if inserted
+  bool insert_or_assign(key_type key, mapped_type value) {
+    assert(key != empty_key_ && "empty key shouldn't be used");
+    assert(value <= max_value && "reserved value shouldn't be used");
+    const epoch_guard guard(*this);
+    table *t = root_.load(std::memory_order_seq_cst);
+    for (;;) {
+      help_migrate(t);
+      slot *s = claim(t, key);
+      if (s == nullptr) {
+        t = claim_next(t);
+        continue;
+      }
+      start_migration(t);
+      mapped_type v = s->value.load(std::memory_order_acquire);
+      while (v != moved_value) {
+        if (s->value.compare_exchange_weak(v, value,
+                                           std::memory_order_acq_rel)) {
+          if (v == null_value || v == tombstone_value) {
+            size_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+          return false;
+        }
+      }
+      t = t->next.load(std::memory_order_acquire);
+    }
+  }
+
+  size_type erase(key_type key) {
+    assert(key != empty_key_ && "empty key shouldn't be used");
+    const epoch_guard guard(*this);
+    for (table *t = root_.load(std::memory_order_seq_cst); t != nullptr;
+         t = t->next.load(std::memory_order_acquire)) {
+      help_migrate(t);
+      bool full = false;
+      slot *s = lookup(t, key, full);
+      if (s == nullptr) {
+        if (full) {
+          continue;
+        }
+        return 0;
+      }
+      mapped_type v = s->value.load(std::memory_order_acquire);
+      while (v != moved_value) {
+        if (v == null_value || v == tombstone_value) {
+          return 0;
+        }
+        if (s->value.compare_exchange_weak(v, tombstone_value,
+                                           std::memory_order_acq_rel)) {
+          size_.fetch_sub(1, std::memory_order_relaxed);
+          return 1;
+        }
+      }
+    }
+    return 0;
+  }
+
+  // Lookup
+
+  // Returns true and stores the mapped value in value if key is present
+  bool find(key_type key, mapped_type &value) const {
+    assert(key != empty_key_ && "empty key shouldn't be used");
+    const epoch_guard guard(*this);
+    for (table *t = root_.load(std::memory_order_seq_cst); t != nullptr;
+         t = t->next.load(std::memory_order_acquire)) {
+      bool full = false;
+      slot *s = lookup(t, key, full);
+      if (s == nullptr) {
+        if (full) {
+          continue;
+        }
+        return false;
+      }
+      const mapped_type v = s->value.load(std::memory_order_acquire);
+      if (v == moved_value) {
+        continue;
+      }
+      if (v == null_value || v == tombstone_value) {
+        return false;
+      }
+      value = v;
+      return true;
+    }
+    return false;
+  }
+
+  size_type count(key_type key) const {
+    mapped_type value;
+    return find(key, value) ? 1 : 0;
+  }
+
+  // Bucket interface
+  size_type bucket_count() const noexcept {
+    const epoch_guard guard(*this);
+    return root_.load(std::memory_order_seq_cst)->mask + 1;
+  }
+
+  // Observers
+  hasher hash_function() const { return hasher(); }
+
+private:
+  static constexpr mapped_type null_value = ~mapped_type(0);
+  static constexpr mapped_type tombstone_value = ~mapped_type(0) - 1;
+  static constexpr mapped_type moved_value = ~mapped_type(0) - 2;
+
+  static constexpr size_t min_bucket_count = 1024;
+  static constexpr size_t migrate_chunk_size = 1024;
+  static constexpr size_t cache_line_size = 64;
+  static constexpr size_t num_stripes = 64;
+  static constexpr uint64_t not_retired = ~uint64_t(0);
+
+  struct slot {
+    std::atomic<key_type> key;
+    std::atomic<mapped_type> value;
+  };
+
+  struct table {
+    table(size_t bucket_count, key_type empty_key)
+        : mask(bucket_count - 1), slots(new slot[bucket_count]) {
+      for (size_t i = 0; i < bucket_count; ++i) {
+        slots[i].key.store(empty_key, std::memory_order_relaxed);
+        slots[i].value.store(null_value, std::memory_order_relaxed);
+      }
+    }
+
+    const size_t mask;
+    const std::unique_ptr<slot[]> slots;
+    std::atomic<table *> next = {nullptr};
+    std::atomic<bool> growing = {false};
+    // Epoch in which the migration from this table finished
+    std::atomic<uint64_t> retired = {not_retired};
+    // Keep the frequently written counters off the cache line read by all
+    // operations
+    char pad0_[cache_line_size];
+    std::atomic<size_t> claimed = {0};
+    char pad1_[cache_line_size];
+    std::atomic<size_t> migrate_idx = {0};
+    std::atomic<size_t> migrate_done = {0};
+  };
+
+  // Counts of operations registered in each of the last three epochs
+  struct stripe {
+    std::atomic<size_t> active[3];
+    char pad_[cache_line_size - 3 * sizeof(std::atomic<size_t>)];
+  };
+
+  // Registers the calling thread in the current epoch for its lifetime
+  class epoch_guard {
+  public:
+    explicit epoch_guard(const ConcurrentHashMap &hm) {
+      stripe &s = hm.stripes_[thread_stripe()];
+      for (;;) {
+        const uint64_t epoch = hm.epoch_.load(std::memory_order_seq_cst);
+        active_ = &s.active[epoch % 3];
+        active_->fetch_add(1, std::memory_order_seq_cst);
+        // The epoch may have advanced past the one registered in before the
+        // counter was incremented
+        if (hm.epoch_.load(std::memory_order_seq_cst) == epoch) {
+          return;
+        }
+        active_->fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    epoch_guard(const epoch_guard &) = delete;
+    epoch_guard &operator=(const epoch_guard &) = delete;
+
+    ~epoch_guard() { active_->fetch_sub(1, std::memory_order_release); }
+
+  private:
+    std::atomic<size_t> *active_;
+  };
+
+  static size_t thread_stripe() {
+    static std::atomic<size_t> next_stripe = {0};
+    thread_local const size_t stripe =
+        next_stripe.fetch_add(1, std::memory_order_relaxed) % num_stripes;
+    return stripe;
+  }
+
+  // Advances the epoch if no operation is registered in the previous epoch
+  bool try_advance_epoch() {
+    uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+    for (const auto &s : stripes_) {
+      if (s.active[(epoch + 2) % 3].load(std::memory_order_seq_cst) != 0) {
+        return false;
+      }
+    }
+    return epoch_.compare_exchange_strong(epoch, epoch + 1,
+                                          std::memory_order_seq_cst);
+  }
+
+  // Frees the tables retired at least two epochs ago. Only one thread
+  // reclaims at a time, other threads skip reclaiming instead of waiting.
+  void reclaim() {
+    if (reclaiming_.exchange(true, std::memory_order_acquire)) {
+      return;
+    }
+    if (!try_advance_epoch()) {
+      try_advance_epoch();
+    }
+    const uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+    const table *root = root_.load(std::memory_order_acquire);
+    while (oldest_ != root) {
+      const uint64_t retired = oldest_->retired.load(std::memory_order_acquire);
+      if (retired == not_retired || epoch - retired < 2) {
+        break;
+      }
+      table *next = oldest_->next.load(std::memory_order_relaxed);
+      delete oldest_;
+      oldest_ = next;
+    }
+    reclaiming_.store(false, std::memory_order_release);
+  }
+
+  // Returns the bucket holding key, or nullptr if key isn't in t. Sets full
+  // if t has no empty buckets, in which case key may be in the next table.
+  slot *lookup(table *t, key_type key, bool &full) const {
+    size_t idx = hasher()(key) & t->mask;
+    for (size_t i = 0; i <= t->mask; ++i, idx = (idx + 1) & t->mask) {
+      const key_type k = t->slots[idx].key.load(std::memory_order_acquire);
+      if (k == key) {
+        return &t->slots[idx];
+      }
+      if (k == empty_key_) {
+        return nullptr;
+      }
+    }
+    full = true;
+    return nullptr;
+  }
+
+  // Returns the bucket holding key, claiming an empty bucket if key isn't in
+  // t. Returns nullptr if t has no empty buckets.
+  //
+  // New keys are claimed in the oldest table even while it's being migrated,
+  // so that all operations on a key pass through the same bucket until it's
+  // marked as moved.
+  slot *claim(table *t, key_type key) {
+    size_t idx = hasher()(key) & t->mask;
+    for (size_t i = 0; i <= t->mask; ++i, idx = (idx + 1) & t->mask) {
+      slot &s = t->slots[idx];
+      key_type k = s.key.load(std::memory_order_acquire);
+      if (k == empty_key_ &&
+          s.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+        t->claimed.fetch_add(1, std::memory_order_relaxed);
+        return &s;
+      }
+      if (k == key) {
+        return &s;
+      }
+    }
+    return nullptr;
+  }
+
+  // Starts a migration from t if half of its buckets have been claimed
+  void start_migration(table *t) {
+    if (t->claimed.load(std::memory_order_relaxed) >= (t->mask + 1) / 2 &&
+        t->next.load(std::memory_order_acquire) == nullptr &&
+        root_.load(std::memory_order_acquire) == t) {
+      grow(t);
+    }
+  }
+
+  // Returns the table following t, creating it if necessary
+  table *grow(table *t) {
+    table *next = t->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      return next;
+    }
+    // A table can't be migrated from until the migration into it is done
+    for (table *root = root_.load(std::memory_order_acquire); root != t;
+         root = root_.load(std::memory_order_acquire)) {
+      next = t->next.load(std::memory_order_acquire);
+      if (next != nullptr) {
+        // Another thread finished the migration and started the next one
+        return next;
+      }
+      finish_migration(root);
+    }
+    // Only one thread allocates the next table, instead of every thread
+    // allocating one and all but one freeing theirs
+    if (t->growing.exchange(true, std::memory_order_acq_rel)) {
+      while ((next = t->next.load(std::memory_order_acquire)) == nullptr) {
+        if (!t->growing.load(std::memory_order_acquire)) {
+          // Allocation failed, try again
+          return grow(t);
+        }
+        std::this_thread::yield();
+      }
+      return next;
+    }
+    size_t bucket_count = t->mask + 1;
+    while (bucket_count < 4 * size_.load(std::memory_order_relaxed)) {
+      bucket_count <<= 1;
+    }
+    // Free the tables no longer in use before allocating another one
+    reclaim();
+    table *nt;
+    try {
+      nt = new table(bucket_count, empty_key_);
+    } catch (...) {
+      t->growing.store(false, std::memory_order_release);
+      throw;
+    }
+    t->next.store(nt, std::memory_order_release);
+    return nt;
+  }
+
+  // Returns the table to claim new keys in when t is full. Waits for the
+  // migration from t to finish, so that the next table only ever receives
+  // the keys of t while migrating and can't fill up before it's done.
+  table *claim_next(table *t) {
+    table *next = grow(t);
+    finish_migration(t);
+    return next;
+  }
+
+  // Migrates a chunk of t if a migration from t is in progress
+  void help_migrate(table *t) {
+    if (t->next.load(std::memory_order_acquire) == nullptr ||
+        root_.load(std::memory_order_acquire) != t) {
+      return;
+    }
+    migrate_chunk(t);
+  }
+
+  // Waits for the migration from t to finish, helping while possible
+  void finish_migration(table *t) {
+    if (t->next.load(std::memory_order_acquire) == nullptr) {
+      return;
+    }
+    while (root_.load(std::memory_order_acquire) == t) {
+      if (!migrate_chunk(t)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Returns false if there are no chunks left to migrate
+  bool migrate_chunk(table *t) {
+    const size_t bucket_count = t->mask + 1;
+    const size_t begin =
+        t->migrate_idx.fetch_add(migrate_chunk_size, std::memory_order_relaxed);
+    if (begin >= bucket_count) {
+      return false;
+    }
+    const size_t end = std::min(begin + migrate_chunk_size, bucket_count);
+    table *next = t->next.load(std::memory_order_acquire);
+    for (size_t idx = begin; idx < end; ++idx) {
+      migrate_slot(t->slots[idx], next);
+    }
+    if (t->migrate_done.fetch_add(end - begin, std::memory_order_acq_rel) +
+            (end - begin) ==
+        bucket_count) {
+      if (root_.compare_exchange_strong(t, next, std::memory_order_seq_cst)) {
+        // Operations registered after this epoch can't reach t
+        t->retired.store(epoch_.load(std::memory_order_seq_cst),
+                         std::memory_order_release);
+        reclaim();
+      }
+    }
+    return true;
+  }
+
+  // Copies the value to next and marks the bucket as moved. Until the bucket
+  // is marked other threads operate on the old bucket and never touch the
+  // key in next, so the copy is redone if the value changed meanwhile.
+  void migrate_slot(slot &s, table *next) {
+    slot *ns = nullptr;
+    mapped_type v = s.value.load(std::memory_order_acquire);
+    for (;;) {
+      if (v == null_value || v == tombstone_value) {
+        if (ns != nullptr) {
+          ns->value.store(null_value, std::memory_order_relaxed);
+        }
+        if (s.value.compare_exchange_weak(v, moved_value,
+                                          std::memory_order_acq_rel)) {
+          return;
+        }
+        continue;
+      }
+      if (ns == nullptr) {
+        ns = claim(next, s.key.load(std::memory_order_relaxed));
+        if (ns == nullptr) {
+          assert(false && "migration target table is full");
+          std::terminate();
+        }
+      }
+      ns->value.store(v, std::memory_order_release);
+      if (s.value.compare_exchange_weak(v, moved_value,
+                                        std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+  }
+
+private:
+  const key_type empty_key_;
+  std::atomic<table *> root_;
+  // Oldest table not yet freed, only accessed by the reclaiming thread
+  table *oldest_;
+  std::atomic<uint64_t> epoch_ = {0};
+  std::atomic<bool> reclaiming_ = {false};
+  char pad_[cache_line_size];
+  std::atomic<size_type> size_ = {0};
+  char pad1_[cache_line_size];
+  mutable stripe stripes_[num_stripes];
+};
+
+template <typename Hash>
+constexpr typename ConcurrentHashMap<Hash>::mapped_type
+    ConcurrentHashMap<Hash>::max_value;
+template <typename Hash>
+constexpr typename ConcurrentHashMap<Hash>::mapped_type
+    ConcurrentHashMap<Hash>::null_value;
+template <typename Hash>
+constexpr typename ConcurrentHashMap<Hash>::mapped_type
+    ConcurrentHashMap<Hash>::tombstone_value;
+template <typename Hash>
+constexpr typename ConcurrentHashMap<Hash>::mapped_type
+    ConcurrentHashMap<Hash>::moved_value;
+template <typename Hash>
+constexpr size_t ConcurrentHashMap<Hash>::min_bucket_count;
+template <typename Hash>
+constexpr size_t ConcurrentHashMap<Hash>::migrate_chunk_size;
+template <typename Hash>
+constexpr size_t ConcurrentHashMap<Hash>::cache_line_size;
+template <typename Hash>
+constexpr size_t ConcurrentHashMap<Hash>::num_stripes;
+template <typename Hash>
+constexpr uint64_t ConcurrentHashMap<Hash>::not_retired;
+
+} // namespace rigtorp
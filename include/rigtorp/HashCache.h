@@ -0,0 +1,191 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+HashCache
+
+A fixed capacity cache built on HashMap, using its linear probing and
+backshift deletion. When full the least recently used entry is approximated
+using the CLOCK algorithm and evicted.
+
+Each bucket stores a reference bit next to the key and value. The map is
+created with at least twice the capacity number of buckets, so the load
+factor never exceeds 50%, the map never grows and no memory is allocated
+after construction. The clock hand walks the buckets using the HashMap
+bucket interface.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include <rigtorp/HashMap.h>
+
+namespace rigtorp {
+
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<void>,
+          typename Allocator = std::allocator<std::pair<Key, T>>>
+class HashCache {
+public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<Key, T>;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+
+  struct stats_type {
+    size_type hits = 0;
+    size_type misses = 0;
+    size_type evictions = 0;
+  };
+
+private:
+  struct construct_tag {};
+
+  // Mapped value and reference bit
+  struct entry {
+    entry() = default;
+    template <typename... Args>
+    explicit entry(construct_tag, Args &&... args)
+        : value(std::forward<Args>(args)...), referenced(true) {}
+
+    mapped_type value = mapped_type();
+    bool referenced = false;
+  };
+
+  using map_type =
+      HashMap<Key, entry, Hash, KeyEqual,
+              typename std::allocator_traits<Allocator>::template rebind_alloc<
+                  std::pair<Key, entry>>>;
+
+public:
+  HashCache(size_type capacity, key_type empty_key,
+            const Allocator &alloc = Allocator())
+      : capacity_(capacity),
+        map_(2 * capacity, empty_key,
+             typename map_type::allocator_type(alloc)) {
+    assert(capacity > 0 && "capacity must be non-zero");
+  }
+
+  // Capacity
+  bool empty() const noexcept { return size() == 0; }
+
+  size_type size() const noexcept { return map_.size(); }
+
+  size_type capacity() const noexcept { return capacity_; }
+
+  // Modifiers
+  void clear() noexcept {
+    map_.clear();
+    hand_ = 0;
+  }
+
+  // Inserts value if key is not present, evicting an entry if the cache is
+  // full. Returns a pointer to the mapped value and true if inserted.
+  std::pair<mapped_type *, bool> insert(const value_type &value) {
+    return emplace_impl(value.first, value.second);
+  }
+
+  std::pair<mapped_type *, bool> insert(value_type &&value) {
+    return emplace_impl(value.first, std::move(value.second));
+  }
+
+  template <typename... Args>
+  std::pair<mapped_type *, bool> emplace(Args &&... args) {
+    return emplace_impl(std::forward<Args>(args)...);
+  }
+
+  size_type erase(const key_type &key) { return map_.erase(key); }
+
+  template <typename K> size_type erase(const K &x) { return map_.erase(x); }
+
+  // Lookup
+
+  // Returns a pointer to the mapped value or nullptr on miss. A hit marks the
+  // entry as recently used.
+  mapped_type *find(const key_type &key) { return find_impl(key); }
+
+  template <typename K> mapped_type *find(const K &x) { return find_impl(x); }
+
+  mapped_type &operator[](const key_type &key) {
+    return *emplace_impl(key).first;
+  }
+
+  // Observers
+  const stats_type &stats() const noexcept { return stats_; }
+
+  void reset_stats() noexcept { stats_ = stats_type(); }
+
+  hasher hash_function() const { return map_.hash_function(); }
+
+  key_equal key_eq() const { return map_.key_eq(); }
+
+private:
+  template <typename K, typename... Args>
+  std::pair<mapped_type *, bool> emplace_impl(const K &key, Args &&... args) {
+    if (size() == capacity_) {
+      auto it = map_.find(key);
+      if (it != map_.end()) {
+        stats_.hits++;
+        it->second.referenced = true;
+        return {&it->second.value, false};
+      }
+      evict();
+    }
+    auto res = map_.emplace(key, construct_tag(), std::forward<Args>(args)...);
+    assert(map_.bucket_count() >= 2 * capacity_ && "map shouldn't grow");
+    if (res.second) {
+      stats_.misses++;
+    } else {
+      stats_.hits++;
+      res.first->second.referenced = true;
+    }
+    return {&res.first->second.value, res.second};
+  }
+
+  template <typename K> mapped_type *find_impl(const K &key) {
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+      stats_.misses++;
+      return nullptr;
+    }
+    stats_.hits++;
+    it->second.referenced = true;
+    return &it->second.value;
+  }
+
+  // Advance the clock hand clearing reference bits until an unreferenced
+  // entry is found and evict it
+  void evict() {
+    assert(size() > 0);
+    const size_t mask = map_.bucket_count() - 1;
+    for (;; hand_ = (hand_ + 1) & mask) {
+      if (map_.bucket_size(hand_) == 0) {
+        continue;
+      }
+      auto &e = *map_.begin(hand_);
+      if (e.second.referenced) {
+        e.second.referenced = false;
+        continue;
+      }
+      // Backshift may move another entry into the bucket at the hand
+      map_.erase(map_.find(e.first));
+      stats_.evictions++;
+      return;
+    }
+  }
+
+private:
+  size_type capacity_;
+  map_type map_;
+  size_t hand_ = 0;
+  stats_type stats_;
+};
+} // namespace rigtorp
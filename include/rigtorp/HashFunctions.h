@@ -0,0 +1,443 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+HashFunctions
+
+Hash functors for use as the Hash template argument:
+
+  - Crc32cHash: CRC32C of 64 bit integer keys. Uses the SSE 4.2 crc32
+    instruction when available, otherwise a table driven implementation.
+  - MulXorShiftHash: multiply and xorshift mixing of 64 bit integer keys.
+  - WyHash: wyhash style hash of strings, transparent for std::string,
+    std::string_view and const char *.
+
+The integer hashes provide a batch(keys, hashes, n) function that hashes n
+keys at once with the same result as the scalar hash, for callers hashing
+many keys up front. HashMap itself hashes one key at a time and doesn't use
+it. The best implementation for the running CPU is selected on first use:
+interleaved crc32 instructions for Crc32cHash and AVX2 (4 keys) or AVX-512
+(8 keys per vector, 16 per iteration) for MulXorShiftHash, with a scalar
+fallback. Crc32cHash's scalar hash is dispatched the same way unless SSE 4.2
+is enabled at compile time. Intrinsics are enabled per function, so no
+compiler flags are required.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RIGTORP_HASH_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RIGTORP_HASH_TARGET(t) __attribute__((target(t)))
+#else
+#define RIGTORP_HASH_TARGET(t)
+#endif
+
+namespace rigtorp {
+namespace detail {
+
+// CPU feature detection
+struct cpu_features {
+  bool sse42 = false;
+  bool avx2 = false;
+  bool avx512 = false; // AVX-512 F and DQ
+
+  cpu_features() noexcept {
+#if defined(RIGTORP_HASH_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    sse42 = __builtin_cpu_supports("sse4.2");
+    avx2 = __builtin_cpu_supports("avx2");
+    avx512 = __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512dq");
+#elif defined(RIGTORP_HASH_X86) && defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 1);
+    sse42 = r[2] & (1 << 20);
+    const bool osxsave = r[2] & (1 << 27);
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    __cpuidex(r, 7, 0);
+    avx2 = (xcr0 & 0x6) == 0x6 && (r[1] & (1 << 5));
+    avx512 = (xcr0 & 0xe6) == 0xe6 && (r[1] & (1 << 16)) && (r[1] & (1 << 17));
+#endif
+  }
+
+  static const cpu_features &get() noexcept {
+    static const cpu_features features;
+    return features;
+  }
+};
+
+// CRC32C
+
+inline uint32_t crc32c_scalar(uint64_t key) noexcept {
+  struct table {
+    uint32_t t[256];
+    table() noexcept {
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j) {
+          crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+        }
+        t[i] = crc;
+      }
+    }
+  };
+  static const table table;
+  uint32_t crc = 0;
+  for (int i = 0; i < 8; ++i) {
+    crc = table.t[(crc ^ key) & 0xff] ^ (crc >> 8);
+    key >>= 8;
+  }
+  return crc;
+}
+
+inline void crc32c_batch_scalar(const uint64_t *keys, uint64_t *hashes,
+                                size_t n) noexcept {
+  for (size_t i = 0; i < n; ++i) {
+    hashes[i] = crc32c_scalar(keys[i]);
+  }
+}
+
+#if defined(RIGTORP_HASH_X86)
+RIGTORP_HASH_TARGET("sse4.2")
+inline uint32_t crc32c_sse42(uint64_t key) noexcept {
+  return static_cast<uint32_t>(_mm_crc32_u64(0, key));
+}
+
+// crc32 has a latency of 3 cycles and a throughput of 1, interleave
+// independent keys to hide the latency
+RIGTORP_HASH_TARGET("sse4.2")
+inline void crc32c_batch_sse42(const uint64_t *keys, uint64_t *hashes,
+                               size_t n) noexcept {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const uint64_t h0 = _mm_crc32_u64(0, keys[i]);
+    const uint64_t h1 = _mm_crc32_u64(0, keys[i + 1]);
+    const uint64_t h2 = _mm_crc32_u64(0, keys[i + 2]);
+    const uint64_t h3 = _mm_crc32_u64(0, keys[i + 3]);
+    hashes[i] = h0;
+    hashes[i + 1] = h1;
+    hashes[i + 2] = h2;
+    hashes[i + 3] = h3;
+  }
+  for (; i < n; ++i) {
+    hashes[i] = _mm_crc32_u64(0, keys[i]);
+  }
+}
+#endif
+
+// Multiply xorshift
+
+constexpr uint64_t mul_xorshift_k = 0xd6e8feb86659fd93ull;
+
+inline uint64_t mul_xorshift_scalar(uint64_t x) noexcept {
+  x ^= x >> 32;
+  x *= mul_xorshift_k;
+  x ^= x >> 32;
+  x *= mul_xorshift_k;
+  x ^= x >> 32;
+  return x;
+}
+
+inline void mul_xorshift_batch_scalar(const uint64_t *keys, uint64_t *hashes,
+                                      size_t n) noexcept {
+  for (size_t i = 0; i < n; ++i) {
+    hashes[i] = mul_xorshift_scalar(keys[i]);
+  }
+}
+
+#if defined(RIGTORP_HASH_X86)
+// AVX2 lacks a 64 bit multiply, compose it from 32 bit multiplies
+RIGTORP_HASH_TARGET("avx2")
+inline __m256i mullo_epi64_avx2(__m256i a, __m256i b) noexcept {
+  const __m256i lo = _mm256_mul_epu32(a, b);
+  const __m256i t1 = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+  const __m256i t2 = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+  return _mm256_add_epi64(
+      lo, _mm256_slli_epi64(_mm256_add_epi64(t1, t2), 32));
+}
+
+RIGTORP_HASH_TARGET("avx2")
+inline void mul_xorshift_batch_avx2(const uint64_t *keys, uint64_t *hashes,
+                                    size_t n) noexcept {
+  const __m256i k =
+      _mm256_set1_epi64x(static_cast<long long>(mul_xorshift_k));
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 32));
+    x = mullo_epi64_avx2(x, k);
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 32));
+    x = mullo_epi64_avx2(x, k);
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 32));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(hashes + i), x);
+  }
+  mul_xorshift_batch_scalar(keys + i, hashes + i, n - i);
+}
+
+// Same as _mm512_srli_epi64(x, 32), which triggers a false
+// -Wmaybe-uninitialized warning in GCC
+RIGTORP_HASH_TARGET("avx512f")
+inline __m512i srli32_avx512(__m512i x) noexcept {
+  return _mm512_maskz_srli_epi64(0xff, x, 32);
+}
+
+// Two vectors per iteration to overlap the multiply latency
+RIGTORP_HASH_TARGET("avx512f,avx512dq")
+inline void mul_xorshift_batch_avx512(const uint64_t *keys, uint64_t *hashes,
+                                      size_t n) noexcept {
+  const __m512i k = _mm512_set1_epi64(static_cast<long long>(mul_xorshift_k));
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i x = _mm512_loadu_si512(keys + i);
+    __m512i y = _mm512_loadu_si512(keys + i + 8);
+    x = _mm512_xor_si512(x, srli32_avx512(x));
+    y = _mm512_xor_si512(y, srli32_avx512(y));
+    x = _mm512_mullo_epi64(x, k);
+    y = _mm512_mullo_epi64(y, k);
+    x = _mm512_xor_si512(x, srli32_avx512(x));
+    y = _mm512_xor_si512(y, srli32_avx512(y));
+    x = _mm512_mullo_epi64(x, k);
+    y = _mm512_mullo_epi64(y, k);
+    x = _mm512_xor_si512(x, srli32_avx512(x));
+    y = _mm512_xor_si512(y, srli32_avx512(y));
+    _mm512_storeu_si512(hashes + i, x);
+    _mm512_storeu_si512(hashes + i + 8, y);
+  }
+  for (; i + 8 <= n; i += 8) {
+    __m512i x = _mm512_loadu_si512(keys + i);
+    x = _mm512_xor_si512(x, srli32_avx512(x));
+    x = _mm512_mullo_epi64(x, k);
+    x = _mm512_xor_si512(x, srli32_avx512(x));
+    x = _mm512_mullo_epi64(x, k);
+    x = _mm512_xor_si512(x, srli32_avx512(x));
+    _mm512_storeu_si512(hashes + i, x);
+  }
+  mul_xorshift_batch_scalar(keys + i, hashes + i, n - i);
+}
+#endif
+
+using hash32_fn = uint32_t (*)(uint64_t);
+using batch_fn = void (*)(const uint64_t *, uint64_t *, size_t);
+
+inline hash32_fn crc32c_fn() noexcept {
+#if defined(RIGTORP_HASH_X86)
+  if (cpu_features::get().sse42) {
+    return crc32c_sse42;
+  }
+#endif
+  return crc32c_scalar;
+}
+
+inline batch_fn crc32c_batch_fn() noexcept {
+#if defined(RIGTORP_HASH_X86)
+  if (cpu_features::get().sse42) {
+    return crc32c_batch_sse42;
+  }
+#endif
+  return crc32c_batch_scalar;
+}
+
+inline batch_fn mul_xorshift_batch_fn() noexcept {
+#if defined(RIGTORP_HASH_X86)
+  if (cpu_features::get().avx512) {
+    return mul_xorshift_batch_avx512;
+  }
+  if (cpu_features::get().avx2) {
+    return mul_xorshift_batch_avx2;
+  }
+#endif
+  return mul_xorshift_batch_scalar;
+}
+
+// Pointers to the implementations for the running CPU. They are constant
+// initialized to resolvers that select the implementation on the first call
+// and replace themselves, so later calls are a load and an indirect call
+// without an initialization guard. Static initializers in any translation
+// unit can use them. A template makes the definitions header only.
+template <typename T = void> struct dispatch {
+  static uint32_t crc32c_resolve(uint64_t key) noexcept {
+    const hash32_fn fn = crc32c_fn();
+    crc32c.store(fn, std::memory_order_relaxed);
+    return fn(key);
+  }
+
+  static void crc32c_batch_resolve(const uint64_t *keys, uint64_t *hashes,
+                                   size_t n) noexcept {
+    const batch_fn fn = crc32c_batch_fn();
+    crc32c_batch.store(fn, std::memory_order_relaxed);
+    fn(keys, hashes, n);
+  }
+
+  static void mul_xorshift_batch_resolve(const uint64_t *keys,
+                                         uint64_t *hashes, size_t n) noexcept {
+    const batch_fn fn = mul_xorshift_batch_fn();
+    mul_xorshift_batch.store(fn, std::memory_order_relaxed);
+    fn(keys, hashes, n);
+  }
+
+  static std::atomic<hash32_fn> crc32c;
+  static std::atomic<batch_fn> crc32c_batch;
+  static std::atomic<batch_fn> mul_xorshift_batch;
+};
+
+template <typename T>
+std::atomic<hash32_fn> dispatch<T>::crc32c{dispatch<T>::crc32c_resolve};
+template <typename T>
+std::atomic<batch_fn>
+    dispatch<T>::crc32c_batch{dispatch<T>::crc32c_batch_resolve};
+template <typename T>
+std::atomic<batch_fn> dispatch<T>::mul_xorshift_batch{
+    dispatch<T>::mul_xorshift_batch_resolve};
+
+// wyhash
+
+inline uint64_t wy_mum(uint64_t a, uint64_t b) noexcept {
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 uint128;
+  const uint128 r = static_cast<uint128>(a) * b;
+  return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  uint64_t hi;
+  const uint64_t lo = _umul128(a, b, &hi);
+  return lo ^ hi;
+#else
+  const uint64_t ha = a >> 32, hb = b >> 32, la = uint32_t(a), lb = uint32_t(b);
+  const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  const uint64_t t = rl + (rm0 << 32);
+  uint64_t lo = t + (rm1 << 32);
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+  return lo ^ hi;
+#endif
+}
+
+inline uint64_t wy_r8(const uint8_t *p) noexcept {
+  uint64_t v;
+  std::memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64_t wy_r4(const uint8_t *p) noexcept {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint64_t wy_r3(const uint8_t *p, size_t len) noexcept {
+  return (static_cast<uint64_t>(p[0]) << 16) |
+         (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+}
+
+} // namespace detail
+
+struct Crc32cHash {
+  size_t operator()(uint64_t key) const noexcept {
+#if defined(__SSE4_2__)
+    return _mm_crc32_u64(0, key);
+#elif defined(RIGTORP_HASH_X86)
+    return detail::dispatch<>::crc32c.load(std::memory_order_relaxed)(key);
+#else
+    return detail::crc32c_scalar(key);
+#endif
+  }
+
+  // hashes[i] = operator()(keys[i]) for i in [0, n)
+  static void batch(const uint64_t *keys, uint64_t *hashes,
+                    size_t n) noexcept {
+    detail::dispatch<>::crc32c_batch.load(std::memory_order_relaxed)(
+        keys, hashes, n);
+  }
+};
+
+struct MulXorShiftHash {
+  size_t operator()(uint64_t key) const noexcept {
+    return static_cast<size_t>(detail::mul_xorshift_scalar(key));
+  }
+
+  // hashes[i] = operator()(keys[i]) for i in [0, n)
+  static void batch(const uint64_t *keys, uint64_t *hashes,
+                    size_t n) noexcept {
+    detail::dispatch<>::mul_xorshift_batch.load(std::memory_order_relaxed)(
+        keys, hashes, n);
+  }
+};
+
+struct WyHash {
+  using is_transparent = void;
+
+  size_t operator()(const std::string &s) const noexcept {
+    return static_cast<size_t>(hash(s.data(), s.size()));
+  }
+
+  size_t operator()(const char *s) const noexcept {
+    return static_cast<size_t>(hash(s, std::strlen(s)));
+  }
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+  size_t operator()(std::string_view s) const noexcept {
+    return static_cast<size_t>(hash(s.data(), s.size()));
+  }
+#endif
+
+  static uint64_t hash(const void *key, size_t len,
+                       uint64_t seed = 0) noexcept {
+    using namespace detail;
+    constexpr uint64_t s0 = 0xa0761d6478bd642full, s1 = 0xe7037ed1a0b428dbull,
+                       s2 = 0x8ebc6af09c88c6e3ull, s3 = 0x589965cc75374cc3ull;
+    const uint8_t *p = static_cast<const uint8_t *>(key);
+    seed ^= s0;
+    uint64_t a, b;
+    if (len <= 16) {
+      if (len >= 4) {
+        a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+        b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+      } else if (len > 0) {
+        a = wy_r3(p, len);
+        b = 0;
+      } else {
+        a = b = 0;
+      }
+    } else {
+      size_t i = len;
+      if (i > 48) {
+        uint64_t see1 = seed, see2 = seed;
+        do {
+          seed = wy_mum(wy_r8(p) ^ s1, wy_r8(p + 8) ^ seed);
+          see1 = wy_mum(wy_r8(p + 16) ^ s2, wy_r8(p + 24) ^ see1);
+          see2 = wy_mum(wy_r8(p + 32) ^ s3, wy_r8(p + 40) ^ see2);
+          p += 48;
+          i -= 48;
+        } while (i > 48);
+        seed ^= see1 ^ see2;
+      }
+      while (i > 16) {
+        seed = wy_mum(wy_r8(p) ^ s1, wy_r8(p + 8) ^ seed);
+        i -= 16;
+        p += 16;
+      }
+      a = wy_r8(p + i - 16);
+      b = wy_r8(p + i - 8);
+    }
+    return wy_mum(s1 ^ len, wy_mum(a ^ s1, b ^ seed));
+  }
+};
+} // namespace rigtorp
+
+#undef RIGTORP_HASH_TARGET
+#undef RIGTORP_HASH_X86
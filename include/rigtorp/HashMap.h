@@ -9,7 +9,8 @@ probing.
 
 Advantages:
   - Predictable performance. Doesn't use the allocator unless load factor
-    grows beyond 50%. Linear probing ensures cash efficency.
+    grows beyond the maximum load factor, 50% by default. Linear probing
+    ensures cash efficency.
   - Deletes items by rearranging items and marking slots as empty instead of
     marking items as deleted. This is keeps performance high when there
     is a high rate of churn (many paired inserts and deletes) since otherwise
@@ -18,26 +19,285 @@ Advantages:
 
 Disadvantages:
   - Significant performance degradation at high load factors.
-  - Maximum load factor hard coded to 50%, memory inefficient.
+  - Maximum load factor defaults to 50%, memory inefficient.
   - Memory is not reclaimed on erase.
+
+The probe sequence can be changed using the Probe policy. Linear probing is
+the default. Quadratic and cache line probing reduce primary clustering, but
+since backshift deletion is only valid for linear probing they mark erased
+items with a tombstone key instead. Tombstones count towards the load factor
+and are removed on rehash.
+
+The Clear policy decides how clear() empties the table. By default all buckets
+are swept. GenerationClear stamps each bucket with the generation it was
+written in and clear() only increments the generation, at the cost of an
+extra stamp lookup per probe. TrackedClear records the first few buckets
+written and only sweeps those, falling back to sweeping all buckets.
+
+The Hooks policy is called on slow paths, rehashing and long probe and
+backshift sequences, to allow tracing the causes of latency spikes. It's
+also told about inserted and erased keys, which OrderedIndex uses to
+support ordered scans using range(). By default no hooks are called.
+
+MaxLoad is a std::ratio setting the maximum load factor, including
+tombstones, before the table is grown. Higher load factors can keep the
+table at a smaller power of two bucket count, at the cost of longer probe
+sequences.
  */
 
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <ratio>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h> // _mm_prefetch
+#endif
+
+// GCC considers a function that only prefetches to have no side effects and
+// removes calls to it, so prefetching functions are inlined into the caller
+#if defined(__GNUC__)
+#define RIGTORP_HASHMAP_PREFETCH_INLINE __attribute__((always_inline)) inline
+#else
+#define RIGTORP_HASHMAP_PREFETCH_INLINE inline
+#endif
+
 namespace rigtorp {
 
+namespace detail {
+
+template <typename...> struct make_void { using type = void; };
+
+template <typename T, typename = void>
+struct is_transparent : std::false_type {};
+
+template <typename T>
+struct is_transparent<T, typename make_void<typename T::is_transparent>::type>
+    : std::true_type {};
+
+// True if lookups with K can skip constructing a key, K only makes the
+// condition dependent for use in enable_if
+template <typename Hash, typename KeyEqual, typename K>
+struct is_transparent_lookup
+    : std::integral_constant<bool, is_transparent<Hash>::value &&
+                                       is_transparent<KeyEqual>::value> {};
+
+} // namespace detail
+
+// Probe policies. next() returns the bucket to probe after idx, where n is
+// the number of buckets probed so far. offset() is called once when the
+// buckets are allocated and its result is passed to next().
+
+// Probes consecutive buckets. Supports backshift deletion.
+struct LinearProbing {
+  static constexpr bool backshift = true;
+
+  template <typename Value>
+  static size_t offset(const Value * /*buckets*/) noexcept {
+    return 0;
+  }
+
+  template <typename Value>
+  static size_t next(size_t idx, size_t n, size_t mask,
+                     size_t /*offset*/) noexcept {
+    (void)n;
+    return (idx + 1) & mask;
+  }
+};
+
+// Probes buckets at triangular number offsets from the ideal bucket, which
+// visits all buckets of a power of two sized table.
+struct QuadraticProbing {
+  static constexpr bool backshift = false;
+
+  template <typename Value>
+  static size_t offset(const Value * /*buckets*/) noexcept {
+    return 0;
+  }
+
+  template <typename Value>
+  static size_t next(size_t idx, size_t n, size_t mask,
+                     size_t /*offset*/) noexcept {
+    return (idx + n) & mask;
+  }
+};
+
+// Probes all buckets in the cache line of the ideal bucket before moving on
+// to other cache lines at triangular number offsets. The bucket array
+// doesn't need to be cache line aligned, groups of buckets are shifted by
+// offset() to match the cache lines the buckets are in. If the bucket size
+// doesn't divide the cache line size buckets straddle cache lines and
+// groups are only approximate.
+struct CacheLineProbing {
+  static constexpr bool backshift = false;
+  static constexpr size_t cache_line_size = 64;
+
+  // Number of buckets the first cache line boundary is shifted from an
+  // aligned bucket array
+  template <typename Value>
+  static size_t offset(const Value *buckets) noexcept {
+    if (cache_line_size % sizeof(Value) != 0) {
+      return 0;
+    }
+    return reinterpret_cast<uintptr_t>(buckets) % cache_line_size /
+           sizeof(Value);
+  }
+
+  template <typename Value>
+  static size_t next(size_t idx, size_t n, size_t mask,
+                     size_t offset) noexcept {
+    const size_t group = std::min(group_size(sizeof(Value)), mask + 1);
+    // Position relative to the aligned groups
+    const size_t pos = (idx + offset) & mask;
+    const size_t next = (pos & ~(group - 1)) | ((pos + 1) & (group - 1));
+    if (n % group != 0) {
+      return (next - offset) & mask;
+    }
+    // Wrapped around the group, continue at the same offset in another group
+    return (next + (n / group) * group - offset) & mask;
+  }
+
+private:
+  // Number of buckets per cache line, rounded down to a power of two
+  static constexpr size_t group_size(size_t value_size) noexcept {
+    size_t group = 1;
+    while (group * 2 * value_size <= cache_line_size) {
+      group *= 2;
+    }
+    return group;
+  }
+};
+
+// Key encodings for HashMap::serialize(). varint and delta require integer
+// keys, delta writes the differences between sorted keys.
+enum class KeyEncoding : uint8_t { raw = 0, varint = 1, delta = 2 };
+
+// Clear policies. state tracks which buckets clear() needs to empty, stale()
+// returns true for buckets that are empty even if holding a key.
+
+// Sweeps all buckets.
+struct SweepClear {
+  template <typename Allocator> class state {
+  public:
+    explicit state(const Allocator &) {}
+    void resize(size_t) {}
+    bool stale(size_t) const noexcept { return false; }
+    void touch(size_t) noexcept {}
+    template <typename F> void clear(size_t bucket_count, F &&empty) noexcept {
+      for (size_t idx = 0; idx < bucket_count; ++idx) {
+        empty(idx);
+      }
+    }
+  };
+};
+
+// Buckets written in an older generation are stale. Clearing increments the
+// generation, when the generation wraps around all stamps are reset.
+template <typename Gen = uint8_t> struct GenerationClear {
+  static_assert(std::is_unsigned<Gen>::value,
+                "generation must be an unsigned integer");
+
+  template <typename Allocator> class state {
+  public:
+    explicit state(const Allocator &alloc) : stamps_(alloc) {}
+    void resize(size_t bucket_count) { stamps_.resize(bucket_count, 0); }
+    bool stale(size_t idx) const noexcept { return stamps_[idx] != gen_; }
+    void touch(size_t idx) noexcept { stamps_[idx] = gen_; }
+    template <typename F> void clear(size_t, F &&) noexcept {
+      if (++gen_ == 0) {
+        std::fill(stamps_.begin(), stamps_.end(), Gen(0));
+        gen_ = 1;
+      }
+    }
+
+  private:
+    using allocator_type = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<Gen>;
+    std::vector<Gen, allocator_type> stamps_;
+    Gen gen_ = 1;
+  };
+};
+
+// Records up to Limit written buckets and sweeps only those, unless more
+// buckets were written.
+template <size_t Limit = 64> struct TrackedClear {
+  template <typename Allocator> class state {
+  public:
+    explicit state(const Allocator &) {}
+    void resize(size_t) {}
+    bool stale(size_t) const noexcept { return false; }
+    void touch(size_t idx) noexcept {
+      if (count_ < Limit) {
+        touched_[count_++] = idx;
+      } else {
+        overflow_ = true;
+      }
+    }
+    template <typename F> void clear(size_t bucket_count, F &&empty) noexcept {
+      if (overflow_) {
+        for (size_t idx = 0; idx < bucket_count; ++idx) {
+          empty(idx);
+        }
+      } else {
+        for (size_t i = 0; i < count_; ++i) {
+          empty(touched_[i]);
+        }
+      }
+      count_ = 0;
+      overflow_ = false;
+    }
+
+  private:
+    std::array<size_t, Limit> touched_;
+    size_t count_ = 0;
+    bool overflow_ = false;
+  };
+};
+
+// Hooks policies. Hooks derive from NoHooks and hide the thresholds and
+// functions they use. Hashes passed to hooks are the full hash of the key.
+struct NoHooks {
+  // on_long_probe() is called for lookups and inserts probing more buckets
+  static constexpr size_t probe_threshold = std::numeric_limits<size_t>::max();
+  // on_long_backshift() is called for erases scanning more buckets
+  static constexpr size_t backshift_threshold =
+      std::numeric_limits<size_t>::max();
+  // on_rehash_begin() and on_rehash_end() are called if true
+  static constexpr bool trace_rehash = false;
+
+  void on_rehash_begin(size_t /*bucket_count*/, size_t /*size*/) {}
+  void on_rehash_end(size_t /*bucket_count*/,
+                     std::chrono::steady_clock::duration /*duration*/) {}
+  void on_long_probe(size_t /*hash*/, size_t /*length*/) {}
+  void on_long_backshift(size_t /*hash*/, size_t /*length*/) {}
+
+  // Called when a key is inserted or erased and when the map is cleared.
+  // Not called when rehashing.
+  template <typename Key> void on_insert(const Key & /*key*/) noexcept {}
+  template <typename Key> void on_erase(const Key & /*key*/) noexcept {}
+  void on_clear() noexcept {}
+};
+
 template <typename Key, typename T, typename Hash = std::hash<Key>,
           typename KeyEqual = std::equal_to<void>,
-          typename Allocator = std::allocator<std::pair<Key, T>>>
+          typename Allocator = std::allocator<std::pair<Key, T>>,
+          typename Probe = LinearProbing, typename Clear = SweepClear,
+          typename Hooks = NoHooks, typename MaxLoad = std::ratio<1, 2>>
 class HashMap {
+  static_assert(MaxLoad::num > 0 && MaxLoad::num < MaxLoad::den,
+                "max load factor must be in (0, 1)");
+
 public:
   using key_type = Key;
   using mapped_type = T;
@@ -81,8 +341,7 @@ public:
         : hm_(other.hm_), idx_(other.idx_) {}
 
     void advance_past_empty() {
-      while (idx_ < hm_->buckets_.size() &&
-             key_equal()(hm_->buckets_[idx_].first, hm_->empty_key_)) {
+      while (idx_ < hm_->buckets_.size() && hm_->is_free(idx_)) {
         ++idx_;
       }
     }
@@ -94,22 +353,41 @@ public:
 
   using iterator = hm_iterator<HashMap, value_type>;
   using const_iterator = hm_iterator<const HashMap, const value_type>;
+  // Buckets hold at most one item
+  using local_iterator = value_type *;
+  using const_local_iterator = const value_type *;
 
 public:
   HashMap(size_type bucket_count, key_type empty_key,
           const allocator_type &alloc = allocator_type())
-      : empty_key_(empty_key), buckets_(alloc) {
+      : HashMap(bucket_count, empty_key, empty_key, alloc) {
+    static_assert(Probe::backshift,
+                  "probe policy without backshift requires a tombstone key");
+  }
+
+  // The tombstone key marks erased items when the probe policy doesn't
+  // support backshift deletion
+  HashMap(size_type bucket_count, key_type empty_key, key_type tombstone_key,
+          const allocator_type &alloc = allocator_type())
+      : empty_key_(empty_key), tombstone_key_(tombstone_key), buckets_(alloc),
+        clear_(alloc) {
+    assert((Probe::backshift || !key_equal()(empty_key_, tombstone_key_)) &&
+           "empty key and tombstone key must differ");
     size_t pow2 = 1;
     while (pow2 < bucket_count) {
       pow2 <<= 1;
     }
     buckets_.resize(pow2, std::make_pair(empty_key_, T()));
+    clear_.resize(pow2);
+    probe_offset_ = Probe::offset(buckets_.data());
   }
 
   HashMap(const HashMap &other, size_type bucket_count)
-      : HashMap(bucket_count, other.empty_key_, other.get_allocator()) {
+      : HashMap(std::max(bucket_count, min_bucket_count(other.size())),
+                other.empty_key_, other.tombstone_key_, other.get_allocator()) {
+    hooks_ = other.hooks_;
     for (auto it = other.begin(); it != other.end(); ++it) {
-      insert(*it);
+      emplace_noresize(it->first, it->second);
     }
   }
 
@@ -139,16 +417,20 @@ public:
 
   size_type size() const noexcept { return size_; }
 
-  size_type max_size() const noexcept { return buckets_.max_size() / 2; }
+  size_type max_size() const noexcept {
+    return buckets_.max_size() / MaxLoad::den * MaxLoad::num;
+  }
 
   // Modifiers
   void clear() noexcept {
-    for (auto &b : buckets_) {
-      if (b.first != empty_key_) {
-        b.first = empty_key_;
+    clear_.clear(buckets_.size(), [this](size_t idx) {
+      if (buckets_[idx].first != empty_key_) {
+        buckets_[idx].first = empty_key_;
       }
-    }
+    });
     size_ = 0;
+    tombstones_ = 0;
+    hooks_.on_clear();
   }
 
   std::pair<iterator, bool> insert(const value_type &value) {
@@ -164,16 +446,70 @@ public:
     return emplace_impl(std::forward<Args>(args)...);
   }
 
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const key_type &key, Args &&... args) {
+    return emplace_impl(key, std::forward<Args>(args)...);
+  }
+
+  // Only used if Hash and KeyEqual are transparent, otherwise x is converted
+  // to key_type
+  template <typename K, typename... Args>
+  typename std::enable_if<
+      detail::is_transparent_lookup<Hash, KeyEqual, K>::value,
+      std::pair<iterator, bool>>::type
+  try_emplace(const K &x, Args &&... args) {
+    return emplace_impl(x, std::forward<Args>(args)...);
+  }
+
   void erase(iterator it) { erase_impl(it); }
 
   size_type erase(const key_type &key) { return erase_impl(key); }
 
   template <typename K> size_type erase(const K &x) { return erase_impl(x); }
 
+  // Merges other into this map. Values of keys present in both maps are
+  // combined using combine(mapped_type &value, const mapped_type &other).
+  template <typename F> void merge_from(const HashMap &other, F combine) {
+    assert(&other != this && "can't merge a map with itself");
+    // The union is at least as large as the largest map
+    reserve(std::max(size(), other.size()));
+    merge_impl(other, [&](const value_type &v) {
+      auto res = emplace_impl(v.first, v.second);
+      if (!res.second) {
+        combine(res.first->second, v.second);
+      }
+    });
+  }
+
+  // Merges other into this map, moving values out of other. Values of keys
+  // present in both maps are combined using
+  // combine(mapped_type &value, mapped_type &&other). Other is left empty
+  // with its memory released.
+  template <typename F> void merge(HashMap &&other, F combine) {
+    assert(&other != this && "can't merge a map with itself");
+    reserve(std::max(size(), other.size()));
+    merge_impl(other, [&](value_type &v) {
+      auto res = emplace_impl(v.first, std::move(v.second));
+      if (!res.second) {
+        combine(res.first->second, std::move(v.second));
+      }
+    });
+    HashMap empty(1, other.empty_key_, other.tombstone_key_,
+                  other.get_allocator());
+    empty.hooks_ = std::move(other.hooks_);
+    other.swap(empty);
+    other.hooks_.on_clear();
+  }
+
   void swap(HashMap &other) noexcept {
     std::swap(buckets_, other.buckets_);
     std::swap(size_, other.size_);
+    std::swap(tombstones_, other.tombstones_);
     std::swap(empty_key_, other.empty_key_);
+    std::swap(tombstone_key_, other.tombstone_key_);
+    std::swap(probe_offset_, other.probe_offset_);
+    std::swap(clear_, other.clear_);
+    std::swap(hooks_, other.hooks_);
   }
 
   // Lookup
@@ -191,6 +527,14 @@ public:
     return emplace_impl(key).first->second;
   }
 
+  template <typename K>
+  typename std::enable_if<
+      detail::is_transparent_lookup<Hash, KeyEqual, K>::value,
+      mapped_type &>::type
+  operator[](const K &x) {
+    return emplace_impl(x).first->second;
+  }
+
   size_type count(const key_type &key) const { return count_impl(key); }
 
   template <typename K> size_type count(const K &x) const {
@@ -207,52 +551,391 @@ public:
     return find_impl(x);
   }
 
+  // Prefetches the ideal bucket of key. Prefetching several keys before
+  // finding them overlaps their cache misses.
+  RIGTORP_HASHMAP_PREFETCH_INLINE void prefetch(const key_type &key) const {
+    prefetch_impl(key);
+  }
+
+  template <typename K>
+  RIGTORP_HASHMAP_PREFETCH_INLINE void prefetch(const K &x) const {
+    prefetch_impl(x);
+  }
+
   // Bucket interface
   size_type bucket_count() const noexcept { return buckets_.size(); }
 
   size_type max_bucket_count() const noexcept { return buckets_.max_size(); }
 
+  size_type bucket_size(size_type n) const noexcept {
+    return is_free(n) ? 0 : 1;
+  }
+
+  local_iterator begin(size_type n) noexcept { return &buckets_[n]; }
+
+  const_local_iterator begin(size_type n) const noexcept {
+    return &buckets_[n];
+  }
+
+  const_local_iterator cbegin(size_type n) const noexcept { return begin(n); }
+
+  local_iterator end(size_type n) noexcept {
+    return &buckets_[n] + bucket_size(n);
+  }
+
+  const_local_iterator end(size_type n) const noexcept {
+    return &buckets_[n] + bucket_size(n);
+  }
+
+  const_local_iterator cend(size_type n) const noexcept { return end(n); }
+
   // Hash policy
   void rehash(size_type count) {
-    count = std::max(count, size() * 2);
-    HashMap other(*this, count);
+    count = std::max(count, min_bucket_count(size()));
+    std::chrono::steady_clock::time_point start;
+    if (Hooks::trace_rehash) {
+      hooks_.on_rehash_begin(buckets_.size(), size_);
+      start = std::chrono::steady_clock::now();
+    }
+    // The hooks are moved to the new table before reinserting the items, so
+    // that they see the long probes of reinserting, and moved back if
+    // reinserting throws
+    HashMap other(count, empty_key_, tombstone_key_, get_allocator());
+    other.hooks_ = std::move(hooks_);
+    try {
+      for (auto it = begin(); it != end(); ++it) {
+        other.emplace_noresize(it->first, it->second);
+      }
+    } catch (...) {
+      hooks_ = std::move(other.hooks_);
+      throw;
+    }
     swap(other);
+    if (Hooks::trace_rehash) {
+      hooks_.on_rehash_end(buckets_.size(),
+                           std::chrono::steady_clock::now() - start);
+    }
   }
 
   void reserve(size_type count) {
-    if (count * 2 > buckets_.size()) {
-      rehash(count * 2);
+    if (min_bucket_count(count) > buckets_.size()) {
+      rehash(min_bucket_count(count));
     }
   }
 
+  // Ordered scans
+
+  // Returns a range of the items with keys in [lo, hi) in key order.
+  // Requires the OrderedIndex hooks policy. The range is invalidated by
+  // modifying the map.
+  auto range(const key_type &lo, const key_type &hi) {
+    return hooks_.range(*this, lo, hi);
+  }
+
+  // Serialization
+
+  // Writes all items to w, where w.write(const char *, size_t) writes bytes.
+  // Values and raw keys are written in host byte order.
+  template <typename Writer>
+  void serialize(Writer &w, KeyEncoding encoding = KeyEncoding::raw) const {
+    static_assert(std::is_trivially_copyable<key_type>::value &&
+                      std::is_trivially_copyable<mapped_type>::value,
+                  "keys and values must be trivially copyable");
+    if (encoding != KeyEncoding::raw && !integer_key::value) {
+      throw std::invalid_argument(
+          "HashMap::serialize: key encoding requires integer keys");
+    }
+    char header[magic_size + 2 + 3 * max_varint_size];
+    std::memcpy(header, magic(), magic_size);
+    size_t n = magic_size;
+    header[n++] = serialize_version;
+    header[n++] = static_cast<char>(encoding);
+    n += encode_varint(sizeof(key_type), header + n);
+    n += encode_varint(sizeof(mapped_type), header + n);
+    n += encode_varint(size_, header + n);
+    w.write(header, n);
+
+    constexpr size_t max_item_size =
+        max_varint_size + sizeof(key_type) + sizeof(mapped_type);
+    std::vector<char> chunk(chunk_size + max_item_size);
+    size_t len = 0, items = 0;
+    uint64_t prev = 0;
+    auto flush = [&]() {
+      char chunk_header[2 * max_varint_size];
+      size_t n = encode_varint(len, chunk_header);
+      n += encode_varint(items, chunk_header + n);
+      w.write(chunk_header, n);
+      w.write(chunk.data(), len);
+      len = 0;
+      items = 0;
+    };
+    auto write_item = [&](const value_type &v) {
+      if (encoding == KeyEncoding::raw) {
+        std::memcpy(chunk.data() + len, &v.first, sizeof(key_type));
+        len += sizeof(key_type);
+      } else {
+        const uint64_t key = key_bits(v.first, integer_key());
+        len += encode_varint(key - prev, chunk.data() + len);
+        prev = encoding == KeyEncoding::delta ? key : 0;
+      }
+      std::memcpy(chunk.data() + len, &v.second, sizeof(mapped_type));
+      len += sizeof(mapped_type);
+      items++;
+      if (len >= chunk_size) {
+        flush();
+      }
+    };
+    if (encoding == KeyEncoding::delta) {
+      // Sorting copies is faster than sorting pointers into the buckets
+      std::vector<value_type> sorted(begin(), end());
+      std::sort(sorted.begin(), sorted.end(),
+                [](const value_type &a, const value_type &b) {
+                  return key_bits(a.first, integer_key()) <
+                         key_bits(b.first, integer_key());
+                });
+      for (const auto &v : sorted) {
+        write_item(v);
+      }
+    } else {
+      for (const auto &v : *this) {
+        write_item(v);
+      }
+    }
+    if (len > 0) {
+      flush();
+    }
+    // Zero chunk length terminates the stream
+    const char end = 0;
+    w.write(&end, 1);
+  }
+
+  // Replaces all items with items read from r, where r.read(char *, size_t)
+  // reads bytes and returns false on failure. Never reads past the end of
+  // the serialized map. Throws std::runtime_error on malformed input, in
+  // which case the map is left unchanged.
+  template <typename Reader> void deserialize(Reader &r) {
+    static_assert(std::is_trivially_copyable<key_type>::value &&
+                      std::is_trivially_copyable<mapped_type>::value,
+                  "keys and values must be trivially copyable");
+    // Read into a new map and swap it in when done
+    HashMap other(1, empty_key_, tombstone_key_, get_allocator());
+    other.hooks_ = hooks_;
+    other.hooks_.on_clear();
+    other.deserialize_impl(r);
+    swap(other);
+  }
+
   // Observers
   hasher hash_function() const { return hasher(); }
 
   key_equal key_eq() const { return key_equal(); }
 
+  Hooks &hooks() noexcept { return hooks_; }
+
+  const Hooks &hooks() const noexcept { return hooks_; }
+
+  // Debugging
+
+  // Returns true if the item and tombstone counts match the buckets and every
+  // item is the first match on the probe sequence from its ideal bucket,
+  // without an empty bucket in between. O(n) for good hash functions.
+  bool check_invariants() const {
+    size_t items = 0;
+    size_t tombstones = 0;
+    for (size_t idx = 0; idx < buckets_.size(); ++idx) {
+      if (is_empty(idx)) {
+        continue;
+      }
+      if (is_tombstone(idx)) {
+        tombstones++;
+        continue;
+      }
+      items++;
+      const key_type &key = buckets_[idx].first;
+      size_t probe = key_to_idx(key);
+      for (size_t n = 1; probe != idx; probe = probe_next(probe, n++)) {
+        if (n > buckets_.size() || is_empty(probe) ||
+            (!is_tombstone(probe) && key_equal()(buckets_[probe].first, key))) {
+          return false;
+        }
+      }
+    }
+    return items == size_ && tombstones == tombstones_;
+  }
+
 private:
+  // key_type is only constructed from key when inserting
   template <typename K, typename... Args>
   std::pair<iterator, bool> emplace_impl(const K &key, Args &&... args) {
     assert(!key_equal()(empty_key_, key) && "empty key shouldn't be used");
-    reserve(size_ + 1);
-    for (size_t idx = key_to_idx(key);; idx = probe_next(idx)) {
-      if (key_equal()(buckets_[idx].first, empty_key_)) {
+    assert((Probe::backshift || !key_equal()(tombstone_key_, key)) &&
+           "tombstone key shouldn't be used");
+    if (min_bucket_count(size_ + tombstones_ + 1) > buckets_.size()) {
+      // Rehashing also removes all tombstones, don't shrink if mostly
+      // tombstones
+      rehash(std::max(buckets_.size(), min_bucket_count(size_ + 1)));
+    }
+    auto res = emplace_noresize(key, std::forward<Args>(args)...);
+    if (res.second) {
+      hooks_.on_insert(res.first->first);
+    }
+    return res;
+  }
+
+  // Requires room for one more item without exceeding the max load factor
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> emplace_noresize(const K &key, Args &&... args) {
+    size_t tombstone = buckets_.size();
+    for (size_t idx = key_to_idx(key), n = 1;; idx = probe_next(idx, n++)) {
+      if (is_empty(idx)) {
+        // Reuse the first tombstone in the probe sequence
+        if (tombstone != buckets_.size()) {
+          idx = tombstone;
+          tombstones_--;
+        }
         buckets_[idx].second = mapped_type(std::forward<Args>(args)...);
         buckets_[idx].first = key;
+        clear_.touch(idx);
         size_++;
+        trace_probe(key, n);
         return {iterator(this, idx), true};
+      } else if (is_tombstone(idx)) {
+        if (tombstone == buckets_.size()) {
+          tombstone = idx;
+        }
       } else if (key_equal()(buckets_[idx].first, key)) {
+        trace_probe(key, n);
         return {iterator(this, idx), false};
       }
     }
   }
 
+  // Reads items into this empty map
+  template <typename Reader> void deserialize_impl(Reader &r) {
+    char header[magic_size + 2];
+    read_bytes(r, header, sizeof(header));
+    if (std::memcmp(header, magic(), magic_size) != 0 ||
+        header[magic_size] != serialize_version) {
+      throw std::runtime_error("HashMap::deserialize: bad header");
+    }
+    const auto encoding = static_cast<KeyEncoding>(header[magic_size + 1]);
+    if (encoding > KeyEncoding::delta ||
+        (encoding != KeyEncoding::raw && !integer_key::value)) {
+      throw std::runtime_error("HashMap::deserialize: bad key encoding");
+    }
+    if (read_varint(r) != sizeof(key_type) ||
+        read_varint(r) != sizeof(mapped_type)) {
+      throw std::runtime_error("HashMap::deserialize: type size mismatch");
+    }
+    const uint64_t count = read_varint(r);
+    if (count > max_size()) {
+      throw std::runtime_error("HashMap::deserialize: bad item count");
+    }
+    // Don't trust the count for allocating more than a bounded amount up
+    // front, the map is otherwise grown for each chunk actually read
+    reserve(std::min(count, uint64_t(max_deserialize_reserve)));
+
+    std::vector<char> chunk;
+    uint64_t total = 0, prev = 0;
+    for (;;) {
+      const uint64_t len = read_varint(r);
+      if (len == 0) {
+        break;
+      }
+      const uint64_t items = read_varint(r);
+      // Each item takes at least one byte for the key and the value, so the
+      // chunk length bounds the items to make room for
+      const size_t min_item_size =
+          (encoding == KeyEncoding::raw ? sizeof(key_type) : 1) +
+          sizeof(mapped_type);
+      if (len > chunk_size + max_varint_size + sizeof(key_type) +
+                    sizeof(mapped_type) ||
+          items > count - total || items > len / min_item_size) {
+        throw std::runtime_error("HashMap::deserialize: bad chunk");
+      }
+      total += items;
+      // Checking the chunk up front allows inserting without rehashing
+      reserve(size_ + items);
+      chunk.resize(len);
+      read_bytes(r, chunk.data(), len);
+      const char *p = chunk.data();
+      const char *end = p + len;
+      for (uint64_t i = 0; i < items; ++i) {
+        key_type key;
+        if (encoding == KeyEncoding::raw) {
+          if (static_cast<size_t>(end - p) < sizeof(key_type)) {
+            throw std::runtime_error("HashMap::deserialize: bad chunk");
+          }
+          std::memcpy(&key, p, sizeof(key_type));
+          p += sizeof(key_type);
+        } else {
+          uint64_t delta;
+          p = decode_varint(p, end, delta);
+          prev = encoding == KeyEncoding::delta ? prev + delta : delta;
+          key = bits_key(prev, integer_key());
+        }
+        mapped_type value;
+        if (static_cast<size_t>(end - p) < sizeof(mapped_type)) {
+          throw std::runtime_error("HashMap::deserialize: bad chunk");
+        }
+        std::memcpy(&value, p, sizeof(mapped_type));
+        p += sizeof(mapped_type);
+        if (key_equal()(key, empty_key_) ||
+            (!Probe::backshift && key_equal()(key, tombstone_key_))) {
+          throw std::runtime_error("HashMap::deserialize: reserved key");
+        }
+        if (emplace_noresize(key, value).second) {
+          hooks_.on_insert(key);
+        }
+      }
+      if (p != end) {
+        throw std::runtime_error("HashMap::deserialize: bad chunk");
+      }
+    }
+    if (total != count) {
+      throw std::runtime_error("HashMap::deserialize: bad item count");
+    }
+  }
+
+  // Number of buckets needed to hold count items at the max load factor
+  static size_t min_bucket_count(size_t count) noexcept {
+    return (count * MaxLoad::den + MaxLoad::num - 1) / MaxLoad::num;
+  }
+
+  // Calls f(value) for the items of other in bucket order. Both maps use
+  // the same hash function and power of two bucket counts, so the buckets
+  // of this map are accessed in a few ascending streams. Checking the
+  // buckets directly avoids the iterator skipping empty buckets.
+  template <typename Map, typename F> void merge_impl(Map &other, F f) {
+    for (size_t idx = 0; idx < other.buckets_.size(); ++idx) {
+      if (!other.is_free(idx)) {
+        f(other.buckets_[idx]);
+      }
+    }
+  }
+
   void erase_impl(iterator it) {
     size_t bucket = it.idx_;
-    for (size_t idx = probe_next(bucket);; idx = probe_next(idx)) {
-      if (key_equal()(buckets_[idx].first, empty_key_)) {
+    hooks_.on_erase(buckets_[bucket].first);
+    if (!Probe::backshift) {
+      buckets_[bucket].first = tombstone_key_;
+      size_--;
+      tombstones_++;
+      return;
+    }
+    // Only hash the key if it may be passed to on_long_backshift()
+    const size_t hash =
+        Hooks::backshift_threshold < std::numeric_limits<size_t>::max()
+            ? hasher()(buckets_[bucket].first)
+            : 0;
+    for (size_t idx = probe_next(bucket, 1), n = 1;;
+         idx = probe_next(idx, 1), ++n) {
+      if (is_empty(idx)) {
         buckets_[bucket].first = empty_key_;
         size_--;
+        if (n > Hooks::backshift_threshold) {
+          hooks_.on_long_backshift(hash, n);
+        }
         return;
       }
       size_t ideal = key_to_idx(buckets_[idx].first);
@@ -291,11 +974,13 @@ private:
 
   template <typename K> iterator find_impl(const K &key) {
     assert(!key_equal()(empty_key_, key) && "empty key shouldn't be used");
-    for (size_t idx = key_to_idx(key);; idx = probe_next(idx)) {
-      if (key_equal()(buckets_[idx].first, key)) {
+    for (size_t idx = key_to_idx(key), n = 1;; idx = probe_next(idx, n++)) {
+      if (key_equal()(buckets_[idx].first, key) && !clear_.stale(idx)) {
+        trace_probe(key, n);
         return iterator(this, idx);
       }
-      if (key_equal()(buckets_[idx].first, empty_key_)) {
+      if (is_empty(idx)) {
+        trace_probe(key, n);
         return end();
       }
     }
@@ -305,15 +990,49 @@ private:
     return const_cast<HashMap *>(this)->find_impl(key);
   }
 
+  // n is the number of buckets probed
+  template <typename K> void trace_probe(const K &key, size_t n) {
+    if (n > Hooks::probe_threshold) {
+      hooks_.on_long_probe(hasher()(key), n);
+    }
+  }
+
+  template <typename K>
+  RIGTORP_HASHMAP_PREFETCH_INLINE void prefetch_impl(const K &key) const {
+    const value_type *p = &buckets_[key_to_idx(key)];
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(reinterpret_cast<const char *>(p), _MM_HINT_T0);
+#elif defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+  }
+
   template <typename K>
   size_t key_to_idx(const K &key) const noexcept(noexcept(hasher()(key))) {
     const size_t mask = buckets_.size() - 1;
     return hasher()(key) & mask;
   }
 
-  size_t probe_next(size_t idx) const noexcept {
+  size_t probe_next(size_t idx, size_t n) const noexcept {
     const size_t mask = buckets_.size() - 1;
-    return (idx + 1) & mask;
+    return Probe::template next<value_type>(idx, n, mask, probe_offset_);
+  }
+
+  bool is_empty(size_t idx) const noexcept {
+    return key_equal()(buckets_[idx].first, empty_key_) || clear_.stale(idx);
+  }
+
+  bool is_tombstone(size_t idx) const noexcept {
+    return !Probe::backshift &&
+           key_equal()(buckets_[idx].first, tombstone_key_) &&
+           !clear_.stale(idx);
+  }
+
+  // Returns true if bucket idx doesn't hold an item
+  bool is_free(size_t idx) const noexcept {
+    return is_empty(idx) || is_tombstone(idx);
   }
 
   size_t diff(size_t a, size_t b) const noexcept {
@@ -321,9 +1040,93 @@ private:
     return (buckets_.size() + (a - b)) & mask;
   }
 
+  // Serialization format:
+  //   - 4 byte magic "HMAP", 1 byte version and 1 byte KeyEncoding.
+  //   - varint sizeof(key_type), sizeof(mapped_type) and item count.
+  //   - Chunks of at most chunk_size bytes plus one item, each prefixed by
+  //     varint byte and item count. A zero byte count ends the stream.
+  //   - Items are the key followed by the raw value.
+  using integer_key =
+      std::integral_constant<bool, std::is_integral<key_type>::value &&
+                                       !std::is_same<key_type, bool>::value>;
+  static constexpr size_t max_deserialize_reserve = 1 << 20;
+  static constexpr size_t magic_size = 4;
+  static constexpr char serialize_version = 1;
+  static constexpr size_t chunk_size = 64 * 1024;
+  static constexpr size_t max_varint_size = 10;
+
+  static const char *magic() noexcept { return "HMAP"; }
+
+  static uint64_t key_bits(const key_type &key, std::true_type) noexcept {
+    return static_cast<uint64_t>(
+        static_cast<typename std::make_unsigned<key_type>::type>(key));
+  }
+  static uint64_t key_bits(const key_type &, std::false_type) noexcept {
+    return 0;
+  }
+  static key_type bits_key(uint64_t bits, std::true_type) noexcept {
+    return static_cast<key_type>(bits);
+  }
+  static key_type bits_key(uint64_t, std::false_type) noexcept {
+    return key_type();
+  }
+
+  static size_t encode_varint(uint64_t v, char *buf) noexcept {
+    size_t n = 0;
+    while (v >= 0x80) {
+      buf[n++] = static_cast<char>((v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+    buf[n++] = static_cast<char>(v);
+    return n;
+  }
+
+  static const char *decode_varint(const char *p, const char *end,
+                                   uint64_t &v) {
+    v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (p == end) {
+        throw std::runtime_error("HashMap::deserialize: bad chunk");
+      }
+      const auto b = static_cast<uint8_t>(*p++);
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        return p;
+      }
+    }
+    throw std::runtime_error("HashMap::deserialize: bad varint");
+  }
+
+  template <typename Reader>
+  static void read_bytes(Reader &r, char *buf, size_t n) {
+    if (!r.read(buf, n)) {
+      throw std::runtime_error("HashMap::deserialize: truncated input");
+    }
+  }
+
+  template <typename Reader> static uint64_t read_varint(Reader &r) {
+    char buf[max_varint_size];
+    for (size_t n = 0; n < max_varint_size; ++n) {
+      read_bytes(r, buf + n, 1);
+      if (!(buf[n] & 0x80)) {
+        uint64_t v;
+        decode_varint(buf, buf + n + 1, v);
+        return v;
+      }
+    }
+    throw std::runtime_error("HashMap::deserialize: bad varint");
+  }
+
 private:
   key_type empty_key_;
+  key_type tombstone_key_;
   buckets buckets_;
   size_t size_ = 0;
+  size_t tombstones_ = 0;
+  // Copies keep the offset of the original buckets, so that the probe
+  // sequences of the copied items don't change
+  size_t probe_offset_ = 0;
+  typename Clear::template state<allocator_type> clear_;
+  Hooks hooks_;
 };
 } // namespace rigtorp
@@ -0,0 +1,221 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+HashMapCoroutine
+
+Coroutine lookups for HashMap. co_find(map, key) prefetches the ideal bucket
+of key and suspends, when resumed it finds the key and completes. Running
+many lookups interleaved lets the memory system fetch their buckets in
+parallel instead of stalling on one cache miss at a time:
+
+  std::vector<uint64_t> keys = ...;
+  interleave_find(hm, keys.begin(), keys.end(), 16,
+                  [](uint64_t key, decltype(hm)::const_iterator it) {
+                    // Called for each key in order
+                  });
+
+Requires C++20 coroutines, RIGTORP_HASHMAP_COROUTINES is defined if they
+are available. Otherwise this header is empty and can still be included.
+
+Coroutine frames are recycled by a thread local pool instead of allocated
+on the heap for each lookup.
+ */
+
+#pragma once
+
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#define RIGTORP_HASHMAP_COROUTINES 1
+#endif
+#endif
+
+#ifdef RIGTORP_HASHMAP_COROUTINES
+
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace rigtorp {
+
+namespace detail {
+
+// Free lists of coroutine frames by size class
+class frame_pool {
+public:
+  static constexpr size_t granularity = 64;
+  static constexpr size_t classes = 16;
+
+  frame_pool() = default;
+  frame_pool(const frame_pool &) = delete;
+  frame_pool &operator=(const frame_pool &) = delete;
+
+  ~frame_pool() {
+    for (node *&head : free_) {
+      while (head != nullptr) {
+        node *next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+  }
+
+  void *allocate(size_t n) {
+    if (n > granularity * classes) {
+      return ::operator new(n);
+    }
+    node *&head = free_[(n - 1) / granularity];
+    if (head == nullptr) {
+      return ::operator new(((n - 1) / granularity + 1) * granularity);
+    }
+    node *p = head;
+    head = p->next;
+    return p;
+  }
+
+  void deallocate(void *p, size_t n) noexcept {
+    if (n > granularity * classes) {
+      ::operator delete(p);
+      return;
+    }
+    node *&head = free_[(n - 1) / granularity];
+    head = new (p) node{head};
+  }
+
+  static frame_pool &local() noexcept {
+    thread_local frame_pool pool;
+    return pool;
+  }
+
+private:
+  struct node {
+    node *next;
+  };
+  node *free_[classes] = {};
+};
+
+} // namespace detail
+
+// Handle to a lookup coroutine returning T
+template <typename T> class lookup {
+public:
+  struct promise_type {
+    std::optional<T> value;
+    std::exception_ptr exception;
+
+    lookup get_return_object() noexcept {
+      return lookup(handle::from_promise(*this));
+    }
+    // Runs until the first suspension when created
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_value(T v) { value.emplace(std::move(v)); }
+    void unhandled_exception() noexcept {
+      exception = std::current_exception();
+    }
+
+    static void *operator new(size_t n) {
+      return detail::frame_pool::local().allocate(n);
+    }
+    static void operator delete(void *p, size_t n) noexcept {
+      detail::frame_pool::local().deallocate(p, n);
+    }
+  };
+
+  lookup() noexcept = default;
+
+  lookup(lookup &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+
+  lookup &operator=(lookup &&other) noexcept {
+    if (this != &other) {
+      if (h_) {
+        h_.destroy();
+      }
+      h_ = std::exchange(other.h_, nullptr);
+    }
+    return *this;
+  }
+
+  ~lookup() {
+    if (h_) {
+      h_.destroy();
+    }
+  }
+
+  explicit operator bool() const noexcept { return static_cast<bool>(h_); }
+
+  bool done() const noexcept { return h_.done(); }
+
+  void resume() { h_.resume(); }
+
+  // Returns the result of a completed lookup
+  T get() {
+    assert(done() && "lookup not completed");
+    if (h_.promise().exception) {
+      std::rethrow_exception(h_.promise().exception);
+    }
+    return std::move(*h_.promise().value);
+  }
+
+private:
+  using handle = std::coroutine_handle<promise_type>;
+
+  explicit lookup(handle h) noexcept : h_(h) {}
+
+  handle h_ = nullptr;
+};
+
+// Prefetches the ideal bucket of key, suspends and then returns
+// map.find(key). The key is copied into the coroutine frame.
+template <typename Map, typename K>
+lookup<typename Map::const_iterator> co_find(const Map &map, K key) {
+  map.prefetch(key);
+  co_await std::suspend_always{};
+  co_return map.find(key);
+}
+
+// Finds the keys in [first, last) with up to width lookups in flight,
+// calling f(key, const_iterator) for each key in order.
+template <typename Map, typename InputIt, typename F>
+void interleave_find(const Map &map, InputIt first, InputIt last,
+                     size_t width, F f) {
+  assert(width > 0 && "width must be non-zero");
+  using key_type = typename std::iterator_traits<InputIt>::value_type;
+  using task = lookup<typename Map::const_iterator>;
+
+  std::vector<std::pair<key_type, task>> ring;
+  ring.reserve(width);
+  for (; first != last && ring.size() < width; ++first) {
+    ring.emplace_back(*first, co_find(map, *first));
+  }
+  size_t active = ring.size();
+  for (size_t i = 0; active > 0; i = i + 1 == ring.size() ? 0 : i + 1) {
+    auto &slot = ring[i];
+    if (!slot.second) {
+      continue;
+    }
+    if (!slot.second.done()) {
+      slot.second.resume();
+    }
+    if (slot.second.done()) {
+      f(slot.first, slot.second.get());
+      if (first != last) {
+        slot.first = *first++;
+        slot.second = co_find(map, slot.first);
+      } else {
+        slot.second = task();
+        active--;
+      }
+    }
+  }
+}
+
+} // namespace rigtorp
+
+#endif
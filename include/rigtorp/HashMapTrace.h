@@ -0,0 +1,205 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+HashMapTrace
+
+Records the operations performed on a hash map into a compact binary trace
+that can later be replayed against any map implementation using
+HashMapReplay.
+
+Trace format:
+  - 8 byte magic "HMTRACE1".
+  - One record per operation: 1 byte op, LEB128 varint key and LEB128 varint
+    nanoseconds since the previous record.
+
+Integral keys are recorded as is, other key types are recorded as the value
+of the map's hash function.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace rigtorp {
+
+enum class TraceOp : uint8_t { find = 0, insert = 1, erase = 2 };
+
+struct TraceEvent {
+  TraceOp op;
+  uint64_t key;
+  uint64_t delta_ns; // Nanoseconds since previous event
+};
+
+class TraceWriter {
+public:
+  explicit TraceWriter(std::ostream &os) : os_(os) {
+    os_.write(magic(), magic_size);
+  }
+
+  void write(TraceOp op, uint64_t key) {
+    const auto now = std::chrono::steady_clock::now();
+    const auto delta =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_);
+    last_ = now;
+    write(TraceEvent{op, key, static_cast<uint64_t>(delta.count())});
+  }
+
+  void write(const TraceEvent &ev) {
+    char buf[1 + 2 * max_varint_size];
+    size_t n = 0;
+    buf[n++] = static_cast<char>(ev.op);
+    n += encode_varint(ev.key, buf + n);
+    n += encode_varint(ev.delta_ns, buf + n);
+    os_.write(buf, n);
+  }
+
+  static constexpr size_t magic_size = 8;
+  static const char *magic() noexcept { return "HMTRACE1"; }
+
+private:
+  static constexpr size_t max_varint_size = 10;
+
+  static size_t encode_varint(uint64_t v, char *buf) noexcept {
+    size_t n = 0;
+    while (v >= 0x80) {
+      buf[n++] = static_cast<char>((v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+    buf[n++] = static_cast<char>(v);
+    return n;
+  }
+
+  std::ostream &os_;
+  std::chrono::steady_clock::time_point last_ =
+      std::chrono::steady_clock::now();
+};
+
+class TraceReader {
+public:
+  explicit TraceReader(std::istream &is) : is_(is) {
+    char buf[TraceWriter::magic_size];
+    if (!is_.read(buf, sizeof(buf)) ||
+        !std::equal(buf, buf + sizeof(buf), TraceWriter::magic())) {
+      throw std::runtime_error("TraceReader: invalid trace header");
+    }
+  }
+
+  // Read next event, returns false on end of trace
+  bool next(TraceEvent &ev) {
+    const int op = is_.get();
+    if (op == std::istream::traits_type::eof()) {
+      return false;
+    }
+    if (op > static_cast<int>(TraceOp::erase)) {
+      throw std::runtime_error("TraceReader: invalid op");
+    }
+    ev.op = static_cast<TraceOp>(op);
+    ev.key = decode_varint();
+    ev.delta_ns = decode_varint();
+    return true;
+  }
+
+private:
+  uint64_t decode_varint() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      const int c = is_.get();
+      if (c == std::istream::traits_type::eof()) {
+        throw std::runtime_error("TraceReader: truncated trace");
+      }
+      v |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if (!(c & 0x80)) {
+        return v;
+      }
+    }
+    throw std::runtime_error("TraceReader: invalid varint");
+  }
+
+  std::istream &is_;
+};
+
+// Wraps a map and records all operations performed through the wrapper
+template <typename Map> class HashMapRecorder {
+public:
+  using key_type = typename Map::key_type;
+  using value_type = typename Map::value_type;
+  using size_type = typename Map::size_type;
+  using iterator = typename Map::iterator;
+
+  HashMapRecorder(Map &map, std::ostream &os) : map_(map), writer_(os) {}
+
+  Map &map() noexcept { return map_; }
+
+  iterator begin() noexcept { return map_.begin(); }
+
+  iterator end() noexcept { return map_.end(); }
+
+  size_type size() const noexcept { return map_.size(); }
+
+  std::pair<iterator, bool> insert(const value_type &value) {
+    writer_.write(TraceOp::insert, trace_key(value.first));
+    return map_.insert(value);
+  }
+
+  std::pair<iterator, bool> insert(value_type &&value) {
+    writer_.write(TraceOp::insert, trace_key(value.first));
+    return map_.insert(std::move(value));
+  }
+
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> emplace(const K &key, Args &&... args) {
+    writer_.write(TraceOp::insert, trace_key(key));
+    return map_.emplace(key, std::forward<Args>(args)...);
+  }
+
+  void erase(iterator it) {
+    writer_.write(TraceOp::erase, trace_key(it->first));
+    map_.erase(it);
+  }
+
+  template <typename K> size_type erase(const K &key) {
+    writer_.write(TraceOp::erase, trace_key(key));
+    return map_.erase(key);
+  }
+
+  template <typename K> typename Map::mapped_type &operator[](const K &key) {
+    writer_.write(TraceOp::insert, trace_key(key));
+    return map_[key];
+  }
+
+  template <typename K> iterator find(const K &key) {
+    writer_.write(TraceOp::find, trace_key(key));
+    return map_.find(key);
+  }
+
+  template <typename K> size_type count(const K &key) {
+    writer_.write(TraceOp::find, trace_key(key));
+    return map_.count(key);
+  }
+
+private:
+  template <typename K>
+  typename std::enable_if<std::is_integral<K>::value, uint64_t>::type
+  trace_key(const K &key) const noexcept {
+    return static_cast<uint64_t>(key);
+  }
+
+  template <typename K>
+  typename std::enable_if<!std::is_integral<K>::value, uint64_t>::type
+  trace_key(const K &key) const {
+    return static_cast<uint64_t>(map_.hash_function()(key));
+  }
+
+  Map &map_;
+  TraceWriter writer_;
+};
+
+} // namespace rigtorp
@@ -0,0 +1,419 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+HashMultiMap
+
+A hash multimap using open addressing with linear probing and backward shift
+deletion like HashMap.
+
+Entries with equal keys are stored in adjacent buckets forming a run. Since
+runs are contiguous, equal_range() is a linear scan starting at the first
+entry of the run and count() returns the run length. No memory is allocated
+per key.
+
+To keep runs contiguous entries are kept ordered by their ideal bucket
+(Robin Hood order). Insertion shifts the following entries up to the next
+empty bucket one step forward and deletion shifts entries one step back
+until an empty bucket or an entry in its ideal bucket is reached.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace rigtorp {
+
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<void>,
+          typename Allocator = std::allocator<std::pair<Key, T>>>
+class HashMultiMap {
+public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<Key, T>;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+  using allocator_type = Allocator;
+  using reference = value_type &;
+  using const_reference = const value_type &;
+  using buckets = std::vector<value_type, allocator_type>;
+
+  template <typename ContT, typename IterVal> struct hm_iterator {
+    using difference_type = std::ptrdiff_t;
+    using value_type = IterVal;
+    using pointer = value_type *;
+    using reference = value_type &;
+    using iterator_category = std::forward_iterator_tag;
+
+    bool operator==(const hm_iterator &other) const {
+      return other.hm_ == hm_ && other.idx_ == idx_;
+    }
+    bool operator!=(const hm_iterator &other) const {
+      return !(other == *this);
+    }
+
+    hm_iterator &operator++() {
+      ++idx_;
+      advance_past_empty();
+      return *this;
+    }
+
+    reference operator*() const { return hm_->buckets_[idx_]; }
+    pointer operator->() const { return &hm_->buckets_[idx_]; }
+
+  private:
+    explicit hm_iterator(ContT *hm) : hm_(hm) { advance_past_empty(); }
+    explicit hm_iterator(ContT *hm, size_type idx) : hm_(hm), idx_(idx) {}
+    template <typename OtherContT, typename OtherIterVal>
+    hm_iterator(const hm_iterator<OtherContT, OtherIterVal> &other)
+        : hm_(other.hm_), idx_(other.idx_) {}
+
+    void advance_past_empty() {
+      while (idx_ < hm_->buckets_.size() &&
+             key_equal()(hm_->buckets_[idx_].first, hm_->empty_key_)) {
+        ++idx_;
+      }
+    }
+
+    ContT *hm_ = nullptr;
+    typename ContT::size_type idx_ = 0;
+    friend ContT;
+  };
+
+  // Iterates over a run of equal keys. The position is not masked so that
+  // runs wrapping around the end of the bucket array compare correctly.
+  template <typename ContT, typename IterVal> struct hm_range_iterator {
+    using difference_type = std::ptrdiff_t;
+    using value_type = IterVal;
+    using pointer = value_type *;
+    using reference = value_type &;
+    using iterator_category = std::forward_iterator_tag;
+
+    bool operator==(const hm_range_iterator &other) const {
+      return other.hm_ == hm_ && other.pos_ == pos_;
+    }
+    bool operator!=(const hm_range_iterator &other) const {
+      return !(other == *this);
+    }
+
+    hm_range_iterator &operator++() {
+      ++pos_;
+      return *this;
+    }
+
+    reference operator*() const { return hm_->buckets_[idx()]; }
+    pointer operator->() const { return &hm_->buckets_[idx()]; }
+
+  private:
+    explicit hm_range_iterator(ContT *hm, size_type pos)
+        : hm_(hm), pos_(pos) {}
+
+    size_type idx() const noexcept {
+      return pos_ & (hm_->buckets_.size() - 1);
+    }
+
+    ContT *hm_ = nullptr;
+    typename ContT::size_type pos_ = 0;
+    friend ContT;
+  };
+
+  using iterator = hm_iterator<HashMultiMap, value_type>;
+  using const_iterator = hm_iterator<const HashMultiMap, const value_type>;
+  using range_iterator = hm_range_iterator<HashMultiMap, value_type>;
+  using const_range_iterator =
+      hm_range_iterator<const HashMultiMap, const value_type>;
+
+public:
+  HashMultiMap(size_type bucket_count, key_type empty_key,
+               const allocator_type &alloc = allocator_type())
+      : empty_key_(empty_key), buckets_(alloc) {
+    size_t pow2 = 1;
+    while (pow2 < bucket_count) {
+      pow2 <<= 1;
+    }
+    buckets_.resize(pow2, std::make_pair(empty_key_, T()));
+  }
+
+  HashMultiMap(const HashMultiMap &other, size_type bucket_count)
+      : HashMultiMap(bucket_count, other.empty_key_, other.get_allocator()) {
+    for (auto it = other.begin(); it != other.end(); ++it) {
+      insert(*it);
+    }
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return buckets_.get_allocator();
+  }
+
+  // Iterators
+  iterator begin() noexcept { return iterator(this); }
+
+  const_iterator begin() const noexcept { return const_iterator(this); }
+
+  const_iterator cbegin() const noexcept { return const_iterator(this); }
+
+  iterator end() noexcept { return iterator(this, buckets_.size()); }
+
+  const_iterator end() const noexcept {
+    return const_iterator(this, buckets_.size());
+  }
+
+  const_iterator cend() const noexcept {
+    return const_iterator(this, buckets_.size());
+  }
+
+  // Capacity
+  bool empty() const noexcept { return size() == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  size_type max_size() const noexcept { return buckets_.max_size() / 2; }
+
+  // Modifiers
+  void clear() noexcept {
+    for (auto &b : buckets_) {
+      if (b.first != empty_key_) {
+        b.first = empty_key_;
+      }
+    }
+    size_ = 0;
+  }
+
+  iterator insert(const value_type &value) {
+    return emplace_impl(value.first, value.second);
+  }
+
+  iterator insert(value_type &&value) {
+    return emplace_impl(value.first, std::move(value.second));
+  }
+
+  template <typename... Args> iterator emplace(Args &&... args) {
+    return emplace_impl(std::forward<Args>(args)...);
+  }
+
+  void erase(iterator it) { erase_impl(it); }
+
+  size_type erase(const key_type &key) { return erase_impl(key); }
+
+  template <typename K> size_type erase(const K &x) { return erase_impl(x); }
+
+  void swap(HashMultiMap &other) noexcept {
+    std::swap(buckets_, other.buckets_);
+    std::swap(size_, other.size_);
+    std::swap(empty_key_, other.empty_key_);
+  }
+
+  // Lookup
+  size_type count(const key_type &key) const { return count_impl(key); }
+
+  template <typename K> size_type count(const K &x) const {
+    return count_impl(x);
+  }
+
+  iterator find(const key_type &key) { return find_impl(key); }
+
+  template <typename K> iterator find(const K &x) { return find_impl(x); }
+
+  const_iterator find(const key_type &key) const { return find_impl(key); }
+
+  template <typename K> const_iterator find(const K &x) const {
+    return find_impl(x);
+  }
+
+  std::pair<range_iterator, range_iterator>
+  equal_range(const key_type &key) {
+    return equal_range_impl(key);
+  }
+
+  template <typename K>
+  std::pair<range_iterator, range_iterator> equal_range(const K &x) {
+    return equal_range_impl(x);
+  }
+
+  std::pair<const_range_iterator, const_range_iterator>
+  equal_range(const key_type &key) const {
+    return equal_range_impl(key);
+  }
+
+  template <typename K>
+  std::pair<const_range_iterator, const_range_iterator>
+  equal_range(const K &x) const {
+    return equal_range_impl(x);
+  }
+
+  // Bucket interface
+  size_type bucket_count() const noexcept { return buckets_.size(); }
+
+  size_type max_bucket_count() const noexcept { return buckets_.max_size(); }
+
+  // Hash policy
+  void rehash(size_type count) {
+    count = std::max(count, size() * 2);
+    HashMultiMap other(*this, count);
+    swap(other);
+  }
+
+  void reserve(size_type count) {
+    if (count * 2 > buckets_.size()) {
+      rehash(count * 2);
+    }
+  }
+
+  // Observers
+  hasher hash_function() const { return hasher(); }
+
+  key_equal key_eq() const { return key_equal(); }
+
+private:
+  template <typename K, typename... Args>
+  iterator emplace_impl(const K &key, Args &&... args) {
+    assert(!key_equal()(empty_key_, key) && "empty key shouldn't be used");
+    reserve(size_ + 1);
+    const size_t ideal = key_to_idx(key);
+    size_t idx = ideal;
+    for (;; idx = probe_next(idx)) {
+      if (key_equal()(buckets_[idx].first, empty_key_)) {
+        break;
+      }
+      if (key_equal()(buckets_[idx].first, key)) {
+        // Place after the existing run
+        while (key_equal()(buckets_[idx].first, key)) {
+          idx = probe_next(idx);
+        }
+        shift_forward(idx);
+        break;
+      }
+      if (distance(idx) < diff(idx, ideal)) {
+        // Entries from here on have an ideal bucket after ours
+        shift_forward(idx);
+        break;
+      }
+    }
+    buckets_[idx].second = mapped_type(std::forward<Args>(args)...);
+    buckets_[idx].first = key;
+    size_++;
+    return iterator(this, idx);
+  }
+
+  // Moves the entries from bucket up to the next empty bucket one step
+  // forward, leaving bucket free
+  void shift_forward(size_t bucket) {
+    size_t empty = bucket;
+    while (!key_equal()(buckets_[empty].first, empty_key_)) {
+      empty = probe_next(empty);
+    }
+    for (size_t idx = empty; idx != bucket; idx = probe_prev(idx)) {
+      buckets_[idx] = std::move(buckets_[probe_prev(idx)]);
+    }
+    buckets_[bucket].first = empty_key_;
+  }
+
+  void erase_impl(iterator it) { erase_idx(it.idx_); }
+
+  // Moves the entries after bucket one step back until an empty bucket or an
+  // entry in its ideal bucket is reached
+  void erase_idx(size_t bucket) {
+    for (size_t idx = probe_next(bucket);; idx = probe_next(idx)) {
+      if (key_equal()(buckets_[idx].first, empty_key_) || distance(idx) == 0) {
+        buckets_[bucket].first = empty_key_;
+        size_--;
+        return;
+      }
+      buckets_[bucket] = std::move(buckets_[idx]);
+      bucket = idx;
+    }
+  }
+
+  template <typename K> size_type erase_impl(const K &key) {
+    const auto range = equal_range_impl(key);
+    const size_type n = range.second.pos_ - range.first.pos_;
+    // Each erase shifts the rest of the run back into the first bucket
+    for (size_type i = 0; i < n; ++i) {
+      erase_idx(range.first.idx());
+    }
+    return n;
+  }
+
+  template <typename K> size_t count_impl(const K &key) const {
+    const auto range = equal_range_impl(key);
+    return range.second.pos_ - range.first.pos_;
+  }
+
+  template <typename K> iterator find_impl(const K &key) {
+    assert(!key_equal()(empty_key_, key) && "empty key shouldn't be used");
+    for (size_t idx = key_to_idx(key);; idx = probe_next(idx)) {
+      if (key_equal()(buckets_[idx].first, key)) {
+        return iterator(this, idx);
+      }
+      if (key_equal()(buckets_[idx].first, empty_key_)) {
+        return end();
+      }
+    }
+  }
+
+  template <typename K> const_iterator find_impl(const K &key) const {
+    return const_cast<HashMultiMap *>(this)->find_impl(key);
+  }
+
+  template <typename K>
+  std::pair<range_iterator, range_iterator> equal_range_impl(const K &key) {
+    auto it = find_impl(key);
+    if (it == end()) {
+      return {range_iterator(this, 0), range_iterator(this, 0)};
+    }
+    size_t last = it.idx_;
+    while (key_equal()(buckets_[probe_next(last)].first, key)) {
+      last = probe_next(last);
+    }
+    return {range_iterator(this, it.idx_),
+            range_iterator(this, it.idx_ + diff(last, it.idx_) + 1)};
+  }
+
+  template <typename K>
+  std::pair<const_range_iterator, const_range_iterator>
+  equal_range_impl(const K &key) const {
+    auto range = const_cast<HashMultiMap *>(this)->equal_range_impl(key);
+    return {const_range_iterator(this, range.first.pos_),
+            const_range_iterator(this, range.second.pos_)};
+  }
+
+  template <typename K>
+  size_t key_to_idx(const K &key) const noexcept(noexcept(hasher()(key))) {
+    const size_t mask = buckets_.size() - 1;
+    return hasher()(key) & mask;
+  }
+
+  size_t probe_next(size_t idx) const noexcept {
+    const size_t mask = buckets_.size() - 1;
+    return (idx + 1) & mask;
+  }
+
+  size_t probe_prev(size_t idx) const noexcept {
+    const size_t mask = buckets_.size() - 1;
+    return (idx - 1) & mask;
+  }
+
+  // Distance from the ideal bucket of the entry in bucket idx
+  size_t distance(size_t idx) const noexcept {
+    return diff(idx, key_to_idx(buckets_[idx].first));
+  }
+
+  size_t diff(size_t a, size_t b) const noexcept {
+    const size_t mask = buckets_.size() - 1;
+    return (buckets_.size() + (a - b)) & mask;
+  }
+
+private:
+  key_type empty_key_;
+  buckets buckets_;
+  size_t size_ = 0;
+};
+} // namespace rigtorp
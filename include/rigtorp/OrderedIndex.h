@@ -0,0 +1,217 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+OrderedIndex
+
+A HashMap hooks policy maintaining a sorted index of the keys, allowing
+occasional ordered scans of a map mostly used for point lookups:
+
+  HashMap<int, int, std::hash<int>, std::equal_to<>,
+          std::allocator<std::pair<int, int>>, LinearProbing, SweepClear,
+          OrderedIndex<int>>
+      hm(16, 0);
+  for (auto &e : hm.range(10, 20)) {
+    // Items with keys in [10, 20) in key order
+  }
+
+Inserts and erases are appended to a log and the sorted keys are only
+updated by range(), by sorting the log and merging it into the keys. If the
+log grows larger than the index, the index is instead rebuilt from the map
+when next used. range() iterates over the sorted keys and finds each item
+in the map once as the iterator advances, values are not copied.
+
+Compare must order keys consistently with the map's KeyEqual.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+
+namespace rigtorp {
+
+template <typename Key, typename Compare = std::less<Key>>
+class OrderedIndex : public NoHooks {
+public:
+  using key_type = Key;
+  using size_type = std::size_t;
+
+  // Items of Map with keys in a range of the index
+  template <typename Map> class range_view {
+  public:
+    class iterator {
+    public:
+      using difference_type = std::ptrdiff_t;
+      using value_type = typename Map::value_type;
+      using pointer = value_type *;
+      using reference = value_type &;
+      using iterator_category = std::forward_iterator_tag;
+
+      bool operator==(const iterator &other) const {
+        return other.key_ == key_;
+      }
+      bool operator!=(const iterator &other) const {
+        return !(other == *this);
+      }
+      iterator &operator++() {
+        ++key_;
+        find();
+        return *this;
+      }
+      iterator operator++(int) {
+        iterator tmp = *this;
+        ++*this;
+        return tmp;
+      }
+      reference operator*() const { return *it_; }
+      pointer operator->() const { return &*it_; }
+
+    private:
+      using map_iterator = decltype(std::declval<Map &>().end());
+
+      iterator(Map *map, const key_type *key, const key_type *last)
+          : map_(map), key_(key), last_(last), it_(map->end()) {
+        find();
+      }
+
+      // Finds the item of the current key once per advance
+      void find() {
+        if (key_ != last_) {
+          it_ = map_->find(*key_);
+          assert(it_ != map_->end() && "index out of sync with map");
+        }
+      }
+
+      Map *map_;
+      const key_type *key_;
+      const key_type *last_;
+      map_iterator it_;
+      friend range_view;
+    };
+
+    iterator begin() const { return iterator(map_, first_, last_); }
+    iterator end() const { return iterator(map_, last_, last_); }
+    bool empty() const noexcept { return first_ == last_; }
+    size_type size() const noexcept { return last_ - first_; }
+
+  private:
+    range_view(Map *map, const key_type *first, const key_type *last)
+        : map_(map), first_(first), last_(last) {}
+
+    Map *map_;
+    const key_type *first_;
+    const key_type *last_;
+    friend OrderedIndex;
+  };
+
+  // Hooks
+  void on_insert(const key_type &key) noexcept { record(key, true); }
+
+  void on_erase(const key_type &key) noexcept { record(key, false); }
+
+  void on_clear() noexcept {
+    keys_.clear();
+    log_.clear();
+    rebuild_ = false;
+  }
+
+  // Returns the items of map with keys in [lo, hi), updating the index
+  template <typename Map>
+  range_view<Map> range(Map &map, const key_type &lo, const key_type &hi) {
+    update(map);
+    const auto first =
+        std::lower_bound(keys_.begin(), keys_.end(), lo, Compare());
+    const auto last = std::lower_bound(first, keys_.end(), hi, Compare());
+    return range_view<Map>(&map, keys_.data() + (first - keys_.begin()),
+                           keys_.data() + (last - keys_.begin()));
+  }
+
+  // Number of logged inserts and erases not yet applied to the index
+  size_type pending() const noexcept { return log_.size(); }
+
+private:
+  void record(const key_type &key, bool insert) noexcept {
+    if (rebuild_) {
+      return;
+    }
+    // Rebuilding from the map is cheaper than applying a log larger than
+    // the index. Failing to log also falls back to rebuilding.
+    if (log_.size() >= keys_.size() + min_log_size) {
+      rebuild_ = true;
+      log_.clear();
+      return;
+    }
+    try {
+      log_.emplace_back(key, insert);
+    } catch (...) {
+      rebuild_ = true;
+      log_.clear();
+    }
+  }
+
+  template <typename Map> void update(const Map &map) {
+    if (rebuild_) {
+      std::vector<key_type> keys;
+      keys.reserve(map.size());
+      for (const auto &e : map) {
+        keys.push_back(e.first);
+      }
+      std::sort(keys.begin(), keys.end(), Compare());
+      keys_.swap(keys);
+      rebuild_ = false;
+      return;
+    }
+    if (log_.empty()) {
+      return;
+    }
+    // Stable sort keeps the last operation on each key last
+    std::stable_sort(log_.begin(), log_.end(),
+                     [](const entry &a, const entry &b) {
+                       return Compare()(a.first, b.first);
+                     });
+    std::vector<key_type> keys;
+    keys.reserve(keys_.size() + log_.size());
+    auto k = keys_.begin();
+    for (auto l = log_.begin(); l != log_.end();) {
+      auto last = l;
+      while (last + 1 != log_.end() && !Compare()(l->first, (last + 1)->first)) {
+        ++last;
+      }
+      while (k != keys_.end() && Compare()(*k, l->first)) {
+        keys.push_back(*k++);
+      }
+      if (k != keys_.end() && !Compare()(l->first, *k)) {
+        ++k;
+      }
+      if (last->second) {
+        keys.push_back(last->first);
+      }
+      l = last + 1;
+    }
+    keys.insert(keys.end(), k, keys_.end());
+    keys_.swap(keys);
+    log_.clear();
+  }
+
+  static constexpr size_type min_log_size = 1024;
+
+  // Key and true if inserted, false if erased
+  using entry = std::pair<key_type, bool>;
+
+  std::vector<key_type> keys_;
+  std::vector<entry> log_;
+  bool rebuild_ = false;
+};
+
+template <typename Key, typename Compare>
+constexpr typename OrderedIndex<Key, Compare>::size_type
+    OrderedIndex<Key, Compare>::min_log_size;
+} // namespace rigtorp
@@ -0,0 +1,291 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+/*
+StableHashMap
+
+A hash map where pointers to values stay valid until the value is erased.
+Buckets are a HashMap from key to a 32 bit slot index. Values are stored in
+a slab of fixed size chunks that are never moved, so rehashing and backshift
+deletion only move keys and indices. Erased slots are put on a free list and
+reused by later inserts.
+
+Compared to HashMap a lookup follows one more pointer, but buckets are
+smaller, and values are never copied on rehash. Unlike HashMap, destructors
+are called on erase.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+
+namespace rigtorp {
+
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<void>,
+          typename Allocator = std::allocator<std::pair<Key, T>>>
+class StableHashMap {
+public:
+  using key_type = Key;
+  using mapped_type = T;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+  using index_type = uint32_t;
+
+  static constexpr size_type chunk_size = 1024;
+
+private:
+  using slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+  using slot_allocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<slot>;
+  using slot_traits = std::allocator_traits<slot_allocator>;
+  using map_type =
+      HashMap<Key, index_type, Hash, KeyEqual,
+              typename std::allocator_traits<Allocator>::template rebind_alloc<
+                  std::pair<Key, index_type>>>;
+
+public:
+  StableHashMap(size_type bucket_count, key_type empty_key,
+                const Allocator &alloc = Allocator())
+      : map_(bucket_count, empty_key,
+             typename map_type::allocator_type(alloc)),
+        alloc_(alloc) {}
+
+  StableHashMap(const StableHashMap &) = delete;
+  StableHashMap &operator=(const StableHashMap &) = delete;
+
+  ~StableHashMap() {
+    destroy_values();
+    for (auto chunk : chunks_) {
+      slot_traits::deallocate(alloc_, chunk, chunk_size);
+    }
+  }
+
+  // Capacity
+  bool empty() const noexcept { return size() == 0; }
+
+  size_type size() const noexcept { return map_.size(); }
+
+  // Modifiers
+  void clear() noexcept {
+    destroy_values();
+    map_.clear();
+    free_.clear();
+    next_ = 0;
+  }
+
+  // Returns a pointer to the value of key and true if inserted
+  std::pair<mapped_type *, bool>
+  insert(const std::pair<key_type, mapped_type> &value) {
+    return emplace_impl(value.first, value.second);
+  }
+
+  std::pair<mapped_type *, bool>
+  insert(std::pair<key_type, mapped_type> &&value) {
+    return emplace_impl(value.first, std::move(value.second));
+  }
+
+  template <typename... Args>
+  std::pair<mapped_type *, bool> emplace(Args &&... args) {
+    return emplace_impl(std::forward<Args>(args)...);
+  }
+
+  template <typename K, typename... Args>
+  std::pair<mapped_type *, bool> try_emplace(const K &key, Args &&... args) {
+    return emplace_impl(key, std::forward<Args>(args)...);
+  }
+
+  size_type erase(const key_type &key) { return erase_impl(key); }
+
+  template <typename K> size_type erase(const K &x) { return erase_impl(x); }
+
+  // Lookup
+
+  // Returns a pointer to the value of key or nullptr if not found
+  mapped_type *find(const key_type &key) { return find_impl(key); }
+
+  template <typename K> mapped_type *find(const K &x) { return find_impl(x); }
+
+  const mapped_type *find(const key_type &key) const { return find_impl(key); }
+
+  template <typename K> const mapped_type *find(const K &x) const {
+    return find_impl(x);
+  }
+
+  mapped_type &at(const key_type &key) { return at_impl(key); }
+
+  template <typename K> mapped_type &at(const K &x) { return at_impl(x); }
+
+  const mapped_type &at(const key_type &key) const { return at_impl(key); }
+
+  template <typename K> const mapped_type &at(const K &x) const {
+    return at_impl(x);
+  }
+
+  mapped_type &operator[](const key_type &key) {
+    return *emplace_impl(key).first;
+  }
+
+  template <typename K> mapped_type &operator[](const K &x) {
+    return *emplace_impl(x).first;
+  }
+
+  size_type count(const key_type &key) const { return map_.count(key); }
+
+  template <typename K> size_type count(const K &x) const {
+    return map_.count(x);
+  }
+
+  // Calls f(const key_type &, mapped_type &) for each item
+  template <typename F> void for_each(F f) {
+    for (const auto &e : map_) {
+      f(e.first, value(e.second));
+    }
+  }
+
+  template <typename F> void for_each(F f) const {
+    for (const auto &e : map_) {
+      f(e.first, value(e.second));
+    }
+  }
+
+  // Bucket interface
+  size_type bucket_count() const noexcept { return map_.bucket_count(); }
+
+  // Number of value slots allocated in the slab
+  size_type slab_size() const noexcept { return chunks_.size() * chunk_size; }
+
+  // Hash policy
+  void rehash(size_type count) { map_.rehash(count); }
+
+  void reserve(size_type count) { map_.reserve(count); }
+
+  // Observers
+  hasher hash_function() const { return hasher(); }
+
+  key_equal key_eq() const { return key_equal(); }
+
+private:
+  template <typename K, typename... Args>
+  std::pair<mapped_type *, bool> emplace_impl(const K &key, Args &&... args) {
+    auto res = map_.try_emplace(key);
+    if (!res.second) {
+      return {&value(res.first->second), false};
+    }
+    index_type idx;
+    try {
+      idx = next_slot();
+      new (&slot_at(idx)) mapped_type(std::forward<Args>(args)...);
+    } catch (...) {
+      map_.erase(res.first);
+      throw;
+    }
+    claim_slot();
+    res.first->second = idx;
+    return {&value(idx), true};
+  }
+
+  template <typename K> size_type erase_impl(const K &key) {
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+      return 0;
+    }
+    const index_type idx = it->second;
+    free_.push_back(idx);
+    value(idx).~mapped_type();
+    map_.erase(it);
+    return 1;
+  }
+
+  template <typename K> mapped_type *find_impl(const K &key) {
+    auto it = map_.find(key);
+    return it == map_.end() ? nullptr : &value(it->second);
+  }
+
+  template <typename K> const mapped_type *find_impl(const K &key) const {
+    return const_cast<StableHashMap *>(this)->find_impl(key);
+  }
+
+  template <typename K> mapped_type &at_impl(const K &key) {
+    if (auto p = find_impl(key)) {
+      return *p;
+    }
+    throw std::out_of_range("StableHashMap::at");
+  }
+
+  template <typename K> const mapped_type &at_impl(const K &key) const {
+    return const_cast<StableHashMap *>(this)->at_impl(key);
+  }
+
+  // Returns the slot the next value will be stored in
+  index_type next_slot() {
+    if (!free_.empty()) {
+      return free_.back();
+    }
+    if (next_ == slab_size()) {
+      if (next_ + chunk_size > std::numeric_limits<index_type>::max()) {
+        throw std::length_error("StableHashMap: too many values");
+      }
+      slot *chunk = slot_traits::allocate(alloc_, chunk_size);
+      try {
+        chunks_.push_back(chunk);
+      } catch (...) {
+        slot_traits::deallocate(alloc_, chunk, chunk_size);
+        throw;
+      }
+    }
+    return static_cast<index_type>(next_);
+  }
+
+  void claim_slot() noexcept {
+    if (!free_.empty()) {
+      free_.pop_back();
+    } else {
+      next_++;
+    }
+  }
+
+  slot &slot_at(index_type idx) noexcept {
+    return chunks_[idx / chunk_size][idx % chunk_size];
+  }
+
+  mapped_type &value(index_type idx) noexcept {
+    return *reinterpret_cast<mapped_type *>(&slot_at(idx));
+  }
+
+  const mapped_type &value(index_type idx) const noexcept {
+    return const_cast<StableHashMap *>(this)->value(idx);
+  }
+
+  void destroy_values() noexcept {
+    for (const auto &e : map_) {
+      value(e.second).~mapped_type();
+    }
+  }
+
+private:
+  map_type map_;
+  slot_allocator alloc_;
+  std::vector<slot *> chunks_;
+  std::vector<index_type> free_;
+  size_type next_ = 0;
+};
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+          typename Allocator>
+constexpr typename StableHashMap<Key, T, Hash, KeyEqual, Allocator>::size_type
+    StableHashMap<Key, T, Hash, KeyEqual, Allocator>::chunk_size;
+} // namespace rigtorp
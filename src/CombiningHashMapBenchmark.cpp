@@ -0,0 +1,143 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/CombiningHashMap.h>
+#include <rigtorp/HashMap.h>
+
+#include "ZipfDistribution.h"
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t keys = 100000;
+  size_t iters = 10000000;
+  double skew = 0.99;
+  size_t threshold = 256;
+  unsigned max_threads = std::thread::hardware_concurrency();
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "k:i:s:f:n:t:")) != -1) {
+    switch (opt) {
+    case 'k':
+      keys = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 's':
+      skew = std::stod(optarg);
+      break;
+    case 'f':
+      threshold = std::stoul(optarg);
+      break;
+    case 'n':
+      max_threads = std::stoul(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || keys == 0 || threshold == 0) {
+  usage:
+    std::cerr
+        << "CombiningHashMapBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+           "usage: CombiningHashMapBenchmark [-k keys] [-i iters] [-s skew] "
+           "[-f flush threshold] [-n max threads] [-t 1|2]\n"
+        << std::endl;
+    exit(1);
+  }
+
+  using key = uint64_t;
+  using value = uint64_t;
+
+  struct hash {
+    size_t operator()(uint64_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  // Draw keys up front, sampling the zipf CDF is slower than an update
+  std::vector<std::vector<key>> samples(std::max(max_threads, 1u));
+  for (size_t t = 0; t < samples.size(); ++t) {
+    std::minstd_rand gen(t);
+    zipf_distribution<key> zd(keys, skew);
+    samples[t].resize(iters / samples.size());
+    for (auto &s : samples[t]) {
+      s = zd(gen);
+    }
+  }
+
+  // Runs iters increments split over nthreads threads
+  auto b = [&](const char *n, unsigned nthreads, auto &&run) {
+    std::atomic<unsigned> ready = {0};
+    std::atomic<bool> start = {false};
+    std::vector<std::thread> threads;
+    const size_t per_thread = iters / nthreads;
+    for (unsigned t = 0; t < nthreads; ++t) {
+      threads.emplace_back([&, t] {
+        ready++;
+        while (!start) {
+        }
+        run(t, per_thread);
+      });
+    }
+    while (ready != nthreads) {
+    }
+    auto t0 = steady_clock::now();
+    start = true;
+    for (auto &t : threads) {
+      t.join();
+    }
+    auto t1 = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(t1 - t0);
+    std::cout << n << " " << nthreads << " threads: "
+              << per_thread * nthreads * 1000 / duration.count() << " Mops/s"
+              << std::endl;
+  };
+
+  // Cycles through the thread's samples
+  auto sample = [&](unsigned t, size_t i) {
+    const auto &s = samples[t % samples.size()];
+    return s[i % s.size()];
+  };
+
+  for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    if (type == -1 || type == 1) {
+      CombiningHashMap<key, value, hash> hm(2 * keys, 0, threshold);
+      b("CombiningHashMap", nthreads, [&](unsigned t, size_t n) {
+        CombiningHashMap<key, value, hash>::buffer buf(hm);
+        for (size_t i = 0; i < n; ++i) {
+          buf.update(sample(t, i), 1);
+        }
+      });
+    }
+
+    if (type == -1 || type == 2) {
+      std::mutex mutex;
+      HashMap<key, value, hash> hm(2 * keys, 0);
+      b("std::mutex + HashMap", nthreads, [&](unsigned t, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+          std::lock_guard<std::mutex> lock(mutex);
+          hm[sample(t, i)] += 1;
+        }
+      });
+    }
+  }
+
+  return 0;
+}
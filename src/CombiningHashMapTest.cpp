@@ -0,0 +1,139 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <rigtorp/CombiningHashMap.h>
+
+using namespace rigtorp;
+
+static std::atomic<bool> ok = {true};
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+      ok = false;                                                              \
+    }                                                                          \
+  }(static_cast<bool>(expr)))
+
+struct Max {
+  int operator()(int a, int b) const { return a > b ? a : b; }
+};
+
+// Throws when combining 13
+struct ThrowingPlus {
+  int operator()(int a, int b) const {
+    if (b == 13) {
+      throw std::runtime_error("13");
+    }
+    return a + b;
+  }
+};
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  {
+    // Updates are combined and applied on flush
+    CombiningHashMap<int, int> hm(16, 0, 4);
+    EXPECT(hm.flush_threshold() == 4);
+    int v = 0;
+    {
+      CombiningHashMap<int, int>::buffer buf(hm);
+      buf.update(1, 1);
+      buf.update(1, 2);
+      buf.update(2, 1);
+      EXPECT(buf.size() == 2);
+      EXPECT(!hm.find(1, v));
+      EXPECT(hm.size() == 0);
+      // Reaching the threshold flushes
+      buf.update(3, 1);
+      EXPECT(buf.size() == 0);
+      EXPECT(hm.find(1, v) && v == 3);
+      EXPECT(hm.find(2, v) && v == 1);
+      EXPECT(hm.size() == 3);
+      buf.update(1, 10);
+      buf.flush();
+      EXPECT(buf.size() == 0);
+      EXPECT(hm.find(1, v) && v == 13);
+      buf.update(4, 1);
+    }
+    // Destructor flushes
+    EXPECT(hm.find(4, v) && v == 1);
+    int sum = 0;
+    hm.for_each([&](const std::pair<int, int> &e) { sum += e.second; });
+    EXPECT(sum == 16);
+  }
+
+  {
+    // Custom combine function
+    CombiningHashMap<int, int, std::hash<int>, std::equal_to<>,
+                     std::allocator<std::pair<int, int>>, Max>
+        hm(16, 0);
+    decltype(hm)::buffer buf(hm);
+    buf.update(1, 5);
+    buf.update(1, 3);
+    buf.flush();
+    buf.update(1, 4);
+    buf.flush();
+    int v = 0;
+    EXPECT(hm.find(1, v) && v == 5);
+    // Keys not in the map are combined with T()
+    buf.update(2, -5);
+    buf.update(2, -3);
+    buf.flush();
+    EXPECT(hm.find(2, v) && v == 0);
+  }
+
+  {
+    // Destroying a buffer that fails to flush doesn't throw
+    CombiningHashMap<int, int, std::hash<int>, std::equal_to<>,
+                     std::allocator<std::pair<int, int>>, ThrowingPlus>
+        hm(16, 0);
+    {
+      decltype(hm)::buffer buf(hm);
+      buf.update(1, 13);
+      bool threw = false;
+      try {
+        buf.flush();
+      } catch (const std::runtime_error &) {
+        threw = true;
+      }
+      EXPECT(threw);
+    }
+    EXPECT(hm.size() == 0);
+  }
+
+  {
+    // Concurrent updates
+    const int num_threads = 8;
+    const int iters = 100000;
+    CombiningHashMap<int, int> hm(16, 0, 32);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        CombiningHashMap<int, int>::buffer buf(hm);
+        for (int i = 0; i < iters; ++i) {
+          buf.update(1 + (i * (t + 1)) % 100, 1);
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    long sum = 0;
+    hm.for_each([&](const std::pair<int, int> &e) { sum += e.second; });
+    EXPECT(sum == static_cast<long>(num_threads) * iters);
+    EXPECT(hm.size() == 100);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
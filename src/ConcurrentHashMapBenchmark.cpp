@@ -0,0 +1,137 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/ConcurrentHashMap.h>
+#include <rigtorp/HashMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t count = 1000000;
+  size_t iters = 10000000;
+  unsigned max_threads = std::thread::hardware_concurrency();
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:i:n:t:")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 'n':
+      max_threads = std::stoul(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc) {
+  usage:
+    std::cerr
+        << "ConcurrentHashMapBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+           "usage: ConcurrentHashMapBenchmark [-c count] [-i iters] "
+           "[-n max threads] [-t 1|2]\n"
+        << std::endl;
+    exit(1);
+  }
+
+  struct hash {
+    size_t operator()(uint64_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  // Runs iters operations split over nthreads threads: 50% find, 25% insert
+  // and 25% erase of uniformly random keys
+  auto b = [&](const char *n, unsigned nthreads, auto &&find, auto &&insert,
+               auto &&erase) {
+    std::atomic<unsigned> ready = {0};
+    std::atomic<bool> start = {false};
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; ++t) {
+      threads.emplace_back([&, t] {
+        std::minstd_rand gen(t);
+        std::uniform_int_distribution<uint64_t> ud(1, count);
+        ready++;
+        while (!start) {
+        }
+        for (size_t i = 0; i < iters / nthreads; ++i) {
+          const uint64_t key = ud(gen);
+          switch (i & 3) {
+          case 0:
+            insert(key);
+            break;
+          case 1:
+            erase(key);
+            break;
+          default:
+            find(key);
+          }
+        }
+      });
+    }
+    while (ready != nthreads) {
+    }
+    auto t0 = steady_clock::now();
+    start = true;
+    for (auto &t : threads) {
+      t.join();
+    }
+    auto t1 = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(t1 - t0);
+    std::cout << n << " " << nthreads << " threads: "
+              << iters * 1000 / duration.count() << " Mops/s" << std::endl;
+  };
+
+  for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    if (type == -1 || type == 1) {
+      ConcurrentHashMap<hash> hm(2 * count, 0);
+      b(
+          "ConcurrentHashMap", nthreads,
+          [&](uint64_t k) {
+            uint64_t v;
+            return hm.find(k, v);
+          },
+          [&](uint64_t k) { hm.insert(k, k); },
+          [&](uint64_t k) { hm.erase(k); });
+    }
+
+    if (type == -1 || type == 2) {
+      std::mutex mutex;
+      HashMap<uint64_t, uint64_t, hash> hm(2 * count, 0);
+      b(
+          "std::mutex + HashMap", nthreads,
+          [&](uint64_t k) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return hm.find(k) != hm.end();
+          },
+          [&](uint64_t k) {
+            std::lock_guard<std::mutex> lock(mutex);
+            hm.emplace(k, k);
+          },
+          [&](uint64_t k) {
+            std::lock_guard<std::mutex> lock(mutex);
+            hm.erase(k);
+          });
+    }
+  }
+
+  return 0;
+}
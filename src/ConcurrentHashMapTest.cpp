@@ -0,0 +1,257 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <rigtorp/ConcurrentHashMap.h>
+
+using namespace rigtorp;
+
+static std::atomic<bool> ok = {true};
+
+// Number of live allocations, to check that migrated tables are freed
+static std::atomic<size_t> allocations = {0};
+
+void *operator new(size_t size) {
+  void *p = std::malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  allocations++;
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p != nullptr) {
+    allocations--;
+  }
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+      ok = false;                                                              \
+    }                                                                          \
+  }(static_cast<bool>(expr)))
+
+// Sequential keys all hash to neighbouring buckets, mix them up
+struct Hash {
+  size_t operator()(uint64_t v) const noexcept {
+    return v * 0x9e3779b97f4a7c15ull;
+  }
+};
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  const unsigned num_threads =
+      std::max(4u, std::min(16u, std::thread::hardware_concurrency()));
+
+  // Single threaded
+  {
+    ConcurrentHashMap<Hash> hm(16, 0);
+    uint64_t v = 0;
+    EXPECT(hm.empty());
+    EXPECT(hm.bucket_count() >= 16);
+    EXPECT(!hm.find(1, v));
+    EXPECT(hm.insert(1, 1));
+    EXPECT(!hm.insert(1, 2));
+    EXPECT(hm.find(1, v) && v == 1);
+    EXPECT(hm.count(1) == 1);
+    EXPECT(hm.size() == 1);
+    EXPECT(!hm.insert_or_assign(1, 3));
+    EXPECT(hm.find(1, v) && v == 3);
+    EXPECT(hm.erase(1) == 1);
+    EXPECT(hm.erase(1) == 0);
+    EXPECT(!hm.find(1, v));
+    EXPECT(hm.empty());
+    EXPECT(hm.insert_or_assign(1, 4));
+    EXPECT(hm.find(1, v) && v == 4);
+    EXPECT(hm.insert(2, ConcurrentHashMap<Hash>::max_value));
+    EXPECT(hm.find(2, v) && v == ConcurrentHashMap<Hash>::max_value);
+  }
+
+  {
+    // Growing and cleaning up tombstones by migration
+    ConcurrentHashMap<Hash> hm(16, 0);
+    for (uint64_t i = 1; i <= 100000; ++i) {
+      EXPECT(hm.insert(i, i));
+    }
+    EXPECT(hm.size() == 100000);
+    EXPECT(hm.bucket_count() >= 200000);
+    for (uint64_t i = 1; i <= 100000; ++i) {
+      uint64_t v = 0;
+      EXPECT(hm.find(i, v) && v == i);
+    }
+    // Churn with a constant working set shouldn't grow the table beyond the
+    // first migration
+    uint64_t key = 100001;
+    for (; key <= 400000; ++key) {
+      EXPECT(hm.erase(key - 100000) == 1);
+      EXPECT(hm.insert(key, key));
+    }
+    const auto bucket_count = hm.bucket_count();
+    for (; key <= 2000000; ++key) {
+      EXPECT(hm.erase(key - 100000) == 1);
+      EXPECT(hm.insert(key, key));
+    }
+    EXPECT(hm.size() == 100000);
+    EXPECT(hm.bucket_count() == bucket_count);
+  }
+
+  // Concurrent churn with a constant working set migrates about a hundred
+  // times, the tables replaced by migrations must be freed
+  {
+    ConcurrentHashMap<Hash> hm(16, 0);
+    const uint64_t n = 2000;
+    const uint64_t rounds = 100;
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    const size_t before = allocations;
+    for (unsigned t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        const uint64_t base = t * n * rounds + 1;
+        for (uint64_t i = base; i < base + n; ++i) {
+          EXPECT(hm.insert(i, i));
+        }
+        for (uint64_t i = base + n; i < base + n * rounds; ++i) {
+          EXPECT(hm.erase(i - n) == 1);
+          EXPECT(hm.insert(i, i));
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    EXPECT(hm.size() == num_threads * n);
+    // Tables retired while another thread was in the middle of an operation
+    // are freed by later migrations. Churn until the next migrations, after
+    // which at most the current, the next and one retired table remain. Each
+    // table is two allocations.
+    for (uint64_t i = 1; i <= 2 * num_threads * n; ++i) {
+      const uint64_t key = num_threads * n * rounds + i;
+      EXPECT(hm.insert(key, key));
+      EXPECT(hm.erase(key) == 1);
+    }
+    EXPECT(allocations - before <= 2 * 3);
+  }
+
+  // Concurrent inserts, finds and erases on disjoint keys
+  {
+    ConcurrentHashMap<Hash> hm(16, 0);
+    const uint64_t n = 20000;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        const uint64_t base = t * n + 1;
+        for (int round = 0; round < 3; ++round) {
+          for (uint64_t i = base; i < base + n; ++i) {
+            EXPECT(hm.insert(i, i + round));
+          }
+          for (uint64_t i = base; i < base + n; ++i) {
+            uint64_t v = 0;
+            EXPECT(hm.find(i, v) && v == i + round);
+          }
+          for (uint64_t i = base; i < base + n; i += 2) {
+            EXPECT(hm.erase(i) == 1);
+          }
+          for (uint64_t i = base; i < base + n; ++i) {
+            uint64_t v = 0;
+            EXPECT(hm.find(i, v) == ((i - base) % 2 == 1));
+          }
+          for (uint64_t i = base + 1; i < base + n; i += 2) {
+            EXPECT(hm.erase(i) == 1);
+          }
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    EXPECT(hm.empty());
+  }
+
+  // Oversubscribed inserts of distinct keys. Threads are preempted in the
+  // middle of migrations while others keep inserting, filling the tables
+  // being migrated.
+  {
+    ConcurrentHashMap<Hash> hm(16, 0);
+    const unsigned oversubscribed = 64;
+    const uint64_t n = 20000;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < oversubscribed; ++t) {
+      threads.emplace_back([&, t] {
+        const uint64_t base = t * n + 1;
+        for (uint64_t i = base; i < base + n; ++i) {
+          EXPECT(hm.insert(i, i));
+          if (i % 64 == 0) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    EXPECT(hm.size() == oversubscribed * n);
+    for (uint64_t i = 1; i <= oversubscribed * n; ++i) {
+      uint64_t v = 0;
+      EXPECT(hm.find(i, v) && v == i);
+    }
+  }
+
+  // Concurrent operations on shared keys
+  {
+    ConcurrentHashMap<Hash> hm(16, 0);
+    const uint64_t n = 10000;
+    std::atomic<uint64_t> inserted = {0}, erased = {0};
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        uint64_t ins = 0, era = 0;
+        for (int round = 0; round < 4; ++round) {
+          for (uint64_t i = 1; i <= n; ++i) {
+            const uint64_t key = (i * 7919 + t) % n + 1;
+            ins += hm.insert(key, key);
+            uint64_t v = 0;
+            if (hm.find(key, v)) {
+              EXPECT(v == key);
+            }
+            if ((key + t) % 3 == 0) {
+              era += hm.erase(key);
+            }
+          }
+        }
+        inserted += ins;
+        erased += era;
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    EXPECT(inserted - erased == hm.size());
+    size_t present = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+      uint64_t v = 0;
+      if (hm.find(i, v)) {
+        EXPECT(v == i);
+        present++;
+      }
+    }
+    EXPECT(present == hm.size());
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
@@ -0,0 +1,122 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/HashCache.h>
+#include <rigtorp/HashMap.h>
+
+#include "ZipfDistribution.h"
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t capacity = 100000;
+  size_t keys = 1000000;
+  size_t iters = 10000000;
+  double skew = 0.99;
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:k:i:s:t:")) != -1) {
+    switch (opt) {
+    case 'c':
+      capacity = std::stoul(optarg);
+      break;
+    case 'k':
+      keys = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 's':
+      skew = std::stod(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || capacity == 0 || keys == 0) {
+  usage:
+    std::cerr << "HashCacheBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+                 "usage: HashCacheBenchmark [-c capacity] [-k keys] "
+                 "[-i iters] [-s skew] [-t 1|2]\n"
+              << std::endl;
+    exit(1);
+  }
+
+  using key = size_t;
+  struct value {
+    char buf[24];
+  };
+
+  struct hash {
+    size_t operator()(size_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  // Draw keys up front, sampling the zipf CDF is slower than a cache lookup
+  std::vector<key> samples(iters);
+  {
+    std::minstd_rand gen(0);
+    zipf_distribution<key> zd(keys, skew);
+    for (auto &s : samples) {
+      s = zd(gen);
+    }
+  }
+
+  auto b = [&](const char *n, auto &&get) {
+    size_t hits = 0;
+    auto start = steady_clock::now();
+    for (const auto k : samples) {
+      hits += get(k);
+    }
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(stop - start);
+    std::cout << n << ": mean " << duration.count() / iters
+              << " ns/iter, hit ratio " << static_cast<double>(hits) / iters
+              << std::endl;
+  };
+
+  if (type == -1 || type == 1) {
+    HashCache<key, value, hash> hc(capacity, 0);
+    b("HashCache", [&](key k) { return !hc.emplace(k).second; });
+    std::cout << "  hits " << hc.stats().hits << " misses "
+              << hc.stats().misses << " evictions " << hc.stats().evictions
+              << std::endl;
+  }
+
+  if (type == -1 || type == 2) {
+    // HashMap with an external std::list for LRU order
+    using lru_list = std::list<std::pair<key, value>>;
+    lru_list lru;
+    HashMap<key, lru_list::iterator, hash> hm(2 * capacity, 0);
+    b("HashMap + std::list LRU", [&](key k) {
+      auto it = hm.find(k);
+      if (it != hm.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return true;
+      }
+      if (lru.size() == capacity) {
+        hm.erase(lru.back().first);
+        lru.pop_back();
+      }
+      lru.emplace_front(k, value{});
+      hm.emplace(k, lru.begin());
+      return false;
+    });
+  }
+
+  return 0;
+}
@@ -0,0 +1,146 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include <rigtorp/HashCache.h>
+
+using namespace rigtorp;
+
+static bool ok = true;
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+    }                                                                          \
+    ok = ok && res;                                                            \
+  }(static_cast<bool>(expr)))
+
+struct Hash {
+  size_t operator()(int v) { return v * 7; }
+  size_t operator()(const std::string &v) { return std::stoi(v) * 7; }
+};
+
+struct Equal {
+  bool operator()(int lhs, int rhs) { return lhs == rhs; }
+  bool operator()(int lhs, const std::string &rhs) {
+    return lhs == std::stoi(rhs);
+  }
+};
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  // Capacity
+  {
+    HashCache<int, int> hc(3, 0);
+    EXPECT(hc.empty());
+    EXPECT(hc.size() == 0);
+    EXPECT(hc.capacity() == 3);
+  }
+
+  {
+    // insert(), find()
+    HashCache<int, int> hc(4, 0);
+    auto res = hc.insert({1, 1});
+    EXPECT(res.second);
+    EXPECT(*res.first == 1);
+    res = hc.insert({1, 2});
+    EXPECT(!res.second);
+    EXPECT(*res.first == 1);
+    EXPECT(hc.size() == 1);
+    EXPECT(hc.find(1) != nullptr);
+    EXPECT(*hc.find(1) == 1);
+    EXPECT(hc.find(2) == nullptr);
+    hc[2] = 2;
+    EXPECT(hc.emplace(3, 3).second);
+    EXPECT(hc.size() == 3);
+    EXPECT(*hc.find(2) == 2);
+    EXPECT(*hc.find(3) == 3);
+  }
+
+  {
+    // Heterogeneous lookup
+    HashCache<int, int, Hash, Equal> hc(4, 0);
+    hc[1] = 1;
+    EXPECT(hc.find("1") != nullptr);
+    EXPECT(hc.find("2") == nullptr);
+    EXPECT(hc.erase("1") == 1);
+    EXPECT(hc.erase("1") == 0);
+    EXPECT(hc.empty());
+  }
+
+  {
+    // Eviction never exceeds capacity
+    HashCache<int, int> hc(8, 0);
+    for (int i = 1; i <= 100; ++i) {
+      hc[i] = i;
+      EXPECT(hc.size() == static_cast<size_t>(std::min(i, 8)));
+    }
+    EXPECT(hc.stats().evictions == 92);
+    EXPECT(hc.stats().misses == 100);
+    int present = 0;
+    for (int i = 1; i <= 100; ++i) {
+      if (auto p = hc.find(i)) {
+        EXPECT(*p == i);
+        present++;
+      }
+    }
+    EXPECT(present == 8);
+  }
+
+  {
+    // Referenced entries get a second chance
+    HashCache<int, int> hc(4, 0);
+    for (int i = 1; i <= 4; ++i) {
+      hc[i] = i;
+    }
+    // All entries referenced, first eviction clears all bits and evicts one
+    hc[5] = 5;
+    EXPECT(hc.size() == 4);
+    EXPECT(hc.stats().evictions == 1);
+    // Keep 1..4 hot, 5 was just inserted
+    for (int i = 1; i <= 4; ++i) {
+      hc.find(i);
+    }
+    hc.reset_stats();
+    hc[6] = 6;
+    EXPECT(hc.stats().evictions == 1);
+    EXPECT(hc.find(6) != nullptr);
+  }
+
+  {
+    // erase(), clear()
+    HashCache<int, int> hc(4, 0);
+    hc[1] = 1;
+    hc[2] = 2;
+    EXPECT(hc.erase(1) == 1);
+    EXPECT(hc.erase(1) == 0);
+    EXPECT(hc.find(1) == nullptr);
+    EXPECT(hc.find(2) != nullptr);
+    hc.clear();
+    EXPECT(hc.empty());
+    EXPECT(hc.find(2) == nullptr);
+  }
+
+  {
+    // stats()
+    HashCache<int, int> hc(4, 0);
+    hc[1] = 1;
+    hc.find(1);
+    hc.find(2);
+    EXPECT(hc.stats().hits == 1);
+    EXPECT(hc.stats().misses == 2);
+    EXPECT(hc.stats().evictions == 0);
+    hc.reset_stats();
+    EXPECT(hc.stats().hits == 0);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
@@ -0,0 +1,122 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/HashFunctions.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t count = 4096;
+  size_t iters = 10000;
+  size_t len = 16;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:i:l:")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 'l':
+      len = std::stoul(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || count == 0) {
+  usage:
+    std::cerr
+        << "HashFunctionsBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+           "usage: HashFunctionsBenchmark [-c batch size] [-i iters] "
+           "[-l string length]\n"
+        << std::endl;
+    exit(1);
+  }
+
+  const auto &cpu = detail::cpu_features::get();
+  std::cout << "sse4.2 " << cpu.sse42 << ", avx2 " << cpu.avx2 << ", avx512 "
+            << cpu.avx512 << std::endl;
+
+  std::vector<uint64_t> keys(count);
+  std::vector<uint64_t> hashes(count);
+  {
+    std::mt19937_64 gen(0);
+    for (auto &k : keys) {
+      k = gen();
+    }
+  }
+
+  auto b = [&](const char *n, auto &&f) {
+    uint64_t sum = 0;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) {
+      f();
+      sum += hashes[i % count];
+    }
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(stop - start);
+    std::cout << n << ": "
+              << static_cast<double>(duration.count()) / (iters * count)
+              << " ns/key (checksum " << sum << ")" << std::endl;
+  };
+
+  auto scalar = [&](auto hash) {
+    return [&, hash] {
+      for (size_t i = 0; i < count; ++i) {
+        hashes[i] = hash(keys[i]);
+      }
+    };
+  };
+
+  auto batch = [&](detail::batch_fn fn) {
+    return [&, fn] { fn(keys.data(), hashes.data(), count); };
+  };
+
+  b("Crc32cHash", scalar(Crc32cHash()));
+  b("Crc32cHash::batch", batch(Crc32cHash::batch));
+  b("crc32c_batch_scalar", batch(detail::crc32c_batch_scalar));
+  b("MulXorShiftHash", scalar(MulXorShiftHash()));
+  b("MulXorShiftHash::batch", batch(MulXorShiftHash::batch));
+  b("mul_xorshift_batch_scalar", batch(detail::mul_xorshift_batch_scalar));
+  if (cpu.avx2) {
+    b("mul_xorshift_batch_avx2", batch(detail::mul_xorshift_batch_avx2));
+  }
+  if (cpu.avx512) {
+    b("mul_xorshift_batch_avx512", batch(detail::mul_xorshift_batch_avx512));
+  }
+
+  std::vector<std::string> strings(count);
+  {
+    std::minstd_rand gen(0);
+    for (auto &s : strings) {
+      s.resize(len);
+      for (auto &c : s) {
+        c = static_cast<char>('a' + gen() % 26);
+      }
+    }
+  }
+  auto strings_b = [&](auto hash) {
+    return [&, hash] {
+      for (size_t i = 0; i < count; ++i) {
+        hashes[i] = hash(strings[i]);
+      }
+    };
+  };
+  b("WyHash", strings_b(WyHash()));
+  b("std::hash<std::string>", strings_b(std::hash<std::string>()));
+
+  return 0;
+}
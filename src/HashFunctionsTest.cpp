@@ -0,0 +1,144 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <rigtorp/HashFunctions.h>
+#include <rigtorp/HashMap.h>
+
+using namespace rigtorp;
+
+static bool ok = true;
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+    }                                                                          \
+    ok = ok && res;                                                            \
+  }(static_cast<bool>(expr)))
+
+// Checks that a batch implementation matches the scalar hash for all batch
+// sizes and alignments
+template <typename Scalar, typename Batch>
+bool batch_matches(const std::vector<uint64_t> &keys, Scalar scalar,
+                   Batch batch) {
+  for (size_t n = 0; n <= 40; ++n) {
+    for (size_t offset = 0; offset < 3; ++offset) {
+      std::vector<uint64_t> hashes(n + 1, 0xdead);
+      batch(keys.data() + offset, hashes.data(), n);
+      for (size_t i = 0; i < n; ++i) {
+        if (hashes[i] != scalar(keys[offset + i])) {
+          return false;
+        }
+      }
+      // Doesn't write past the end
+      if (hashes[n] != 0xdead) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  std::vector<uint64_t> keys;
+  {
+    std::mt19937_64 gen(0);
+    for (int i = 0; i < 64; ++i) {
+      keys.push_back(gen());
+    }
+    keys[0] = 0;
+    keys[1] = ~uint64_t(0);
+  }
+  const auto &cpu = detail::cpu_features::get();
+
+  // CRC32C
+  {
+    EXPECT(detail::crc32c_scalar(0) == 0);
+    EXPECT(batch_matches(keys, Crc32cHash(), Crc32cHash::batch));
+    EXPECT(batch_matches(keys, Crc32cHash(), detail::crc32c_batch_scalar));
+#if defined(__x86_64__) || defined(_M_X64)
+    if (cpu.sse42) {
+      for (auto k : keys) {
+        EXPECT(detail::crc32c_sse42(k) == detail::crc32c_scalar(k));
+      }
+      EXPECT(batch_matches(keys, Crc32cHash(), detail::crc32c_batch_sse42));
+    }
+#endif
+  }
+
+  // Multiply xorshift
+  {
+    EXPECT(batch_matches(keys, MulXorShiftHash(), MulXorShiftHash::batch));
+    EXPECT(batch_matches(keys, MulXorShiftHash(),
+                         detail::mul_xorshift_batch_scalar));
+#if defined(__x86_64__) || defined(_M_X64)
+    if (cpu.avx2) {
+      EXPECT(batch_matches(keys, MulXorShiftHash(),
+                           detail::mul_xorshift_batch_avx2));
+    }
+    if (cpu.avx512) {
+      EXPECT(batch_matches(keys, MulXorShiftHash(),
+                           detail::mul_xorshift_batch_avx512));
+    }
+#endif
+    // Sequential keys hash to distinct buckets
+    std::set<size_t> buckets;
+    for (uint64_t k = 0; k < 1024; ++k) {
+      buckets.insert(MulXorShiftHash()(k) & 4095);
+    }
+    EXPECT(buckets.size() > 800);
+  }
+
+  // WyHash
+  {
+    std::string s;
+    std::set<uint64_t> hashes;
+    for (int i = 0; i < 200; ++i) {
+      EXPECT(WyHash()(s) == WyHash()(s.c_str()));
+      hashes.insert(WyHash()(s));
+      s.push_back(static_cast<char>('a' + i % 26));
+    }
+    EXPECT(hashes.size() == 200);
+    // All bytes contribute
+    for (size_t len = 1; len <= 100; ++len) {
+      std::string a(len, 'x');
+      for (size_t i = 0; i < len; ++i) {
+        std::string b = a;
+        b[i] = 'y';
+        EXPECT(WyHash()(a) != WyHash()(b));
+      }
+    }
+    EXPECT(WyHash::hash("abc", 3, 0) != WyHash::hash("abc", 3, 1));
+
+    // Heterogeneous lookup
+    HashMap<std::string, int, WyHash> hm(16, "");
+    hm.emplace("one", 1);
+    EXPECT(hm.find("one") != hm.end());
+    EXPECT(hm.count("two") == 0);
+  }
+
+  {
+    // As Hash template arguments
+    HashMap<uint64_t, int, Crc32cHash> hm1(16, 0);
+    HashMap<uint64_t, int, MulXorShiftHash> hm2(16, 0);
+    for (uint64_t i = 1; i <= 100; ++i) {
+      hm1.emplace(i, 1);
+      hm2.emplace(i, 1);
+    }
+    EXPECT(hm1.size() == 100 && hm1.count(50) == 1);
+    EXPECT(hm2.size() == 100 && hm2.count(50) == 1);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
@@ -6,6 +6,7 @@
 #include <chrono>
 #include <iostream>
 #include <random>
+#include <string>
 #include <unistd.h>
 #include <unordered_map>
 
@@ -50,7 +51,16 @@ template <typename T> struct huge_page_allocator {
   }
 
   void deallocate(T *p, std::size_t n) {
-    munmap(p, round_to_huge_page_size(n));
+    munmap(p, round_to_huge_page_size(n * sizeof(T)));
+  }
+
+  template <class U>
+  bool operator==(const huge_page_allocator<U> &) const noexcept {
+    return true;
+  }
+  template <class U>
+  bool operator!=(const huge_page_allocator<U> &) const noexcept {
+    return false;
   }
 };
 #else
@@ -60,15 +70,37 @@ template <typename T> using huge_page_allocator = std::allocator<T>;
 using namespace std::chrono;
 using namespace rigtorp;
 
+struct Crc32Hash {
+  size_t operator()(size_t h) const noexcept { return _mm_crc32_u64(0, h); }
+};
+
+// Uniformly distributed keys
+struct UniformKeys {
+  size_t operator()(int k) const noexcept { return k; }
+};
+
+// Clustered keys are runs of 32 consecutive integers spaced 1024 apart and
+// are hashed using the identity function to provoke primary clustering
+struct IdentityHash {
+  size_t operator()(size_t h) const noexcept { return h; }
+};
+
+struct ClusteredKeys {
+  size_t operator()(int k) const noexcept {
+    return (static_cast<size_t>(k) / 32) * 1024 + k % 32;
+  }
+};
+
 int main(int argc, char *argv[]) {
   (void)argc, (void)argv;
 
   size_t count = 10000000;
   size_t iters = 100000000;
   int type = -1;
+  bool clustered = false;
 
   int opt;
-  while ((opt = getopt(argc, argv, "i:c:t:")) != -1) {
+  while ((opt = getopt(argc, argv, "i:c:t:d:")) != -1) {
     switch (opt) {
     case 'i':
       iters = std::stol(optarg);
@@ -79,6 +111,13 @@ int main(int argc, char *argv[]) {
     case 't':
       type = std::stoi(optarg);
       break;
+    case 'd':
+      if (std::string(optarg) == "clustered") {
+        clustered = true;
+      } else if (std::string(optarg) != "uniform") {
+        goto usage;
+      }
+      break;
     default:
       goto usage;
     }
@@ -87,7 +126,8 @@ int main(int argc, char *argv[]) {
   if (optind != argc) {
   usage:
     std::cerr << "HashMapBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
-                 "usage: HashMapBenchmark [-c count] [-i iters] [-t 1|2|3|4]\n"
+                 "usage: HashMapBenchmark [-c count] [-i iters] "
+                 "[-t 1|2|3|4|5|6] [-d uniform|clustered]\n"
               << std::endl;
     exit(1);
   }
@@ -97,82 +137,104 @@ int main(int argc, char *argv[]) {
     char buf[24];
   };
 
-  struct hash {
-    size_t operator()(size_t h) const noexcept { return _mm_crc32_u64(0, h); }
-  };
+  // The hash and key distribution are template parameters so that the
+  // uniform runs are unaffected by the clustered option
+  auto run = [&](auto h, auto keys) {
+    using hash = decltype(h);
 
-  auto b = [&](const char *n, auto &m) {
-    std::minstd_rand gen(0);
-    std::uniform_int_distribution<int> ud(2, count);
+    auto b = [&](const char *n, auto &m) {
+      std::minstd_rand gen(0);
+      std::uniform_int_distribution<int> ud(2, count);
 
-    for (size_t i = 0; i < count; ++i) {
-      const int val = ud(gen);
-      m.insert({val, {}});
-    }
-
-    auto start = steady_clock::now();
-    for (size_t i = 0; i < iters; ++i) {
-      const int val = ud(gen);
-      const auto it = m.find(val);
-      if (it == m.end()) {
+      for (size_t i = 0; i < count; ++i) {
+        const key val = keys(ud(gen));
         m.insert({val, {}});
-      } else {
-        m.erase(it);
       }
-    }
-    auto stop = steady_clock::now();
-    auto duration = stop - start;
 
-    nanoseconds max = {};
-    for (size_t i = 0; i < iters; ++i) {
-      const int val = ud(gen);
       auto start = steady_clock::now();
-      const auto it = m.find(val);
-      if (it == m.end()) {
-        m.insert({val, {}});
-      } else {
-        m.erase(it);
+      for (size_t i = 0; i < iters; ++i) {
+        const key val = keys(ud(gen));
+        const auto it = m.find(val);
+        if (it == m.end()) {
+          m.insert({val, {}});
+        } else {
+          m.erase(it);
+        }
       }
       auto stop = steady_clock::now();
-      max = std::max(max, stop - start);
+      auto duration = stop - start;
+
+      nanoseconds max = {};
+      for (size_t i = 0; i < iters; ++i) {
+        const key val = keys(ud(gen));
+        auto start = steady_clock::now();
+        const auto it = m.find(val);
+        if (it == m.end()) {
+          m.insert({val, {}});
+        } else {
+          m.erase(it);
+        }
+        auto stop = steady_clock::now();
+        max = std::max(max, stop - start);
+      }
+
+      std::cout << n << ": mean "
+                << duration_cast<nanoseconds>(duration).count() / iters
+                << " ns/iter, max " << max.count() << " ns/iter" << std::endl;
+    };
+
+    if (type == -1 || type == 1) {
+      HashMap<key, value, hash, std::equal_to<>,
+              huge_page_allocator<std::pair<key, value>>>
+          hm(2 * count, 0);
+      b("HashMap", hm);
     }
 
-    std::cout << n << ": mean "
-              << duration_cast<nanoseconds>(duration).count() / iters
-              << " ns/iter, max " << max.count() << " ns/iter" << std::endl;
-  };
+    if (type == -1 || type == 5) {
+      HashMap<key, value, hash, std::equal_to<>,
+              huge_page_allocator<std::pair<key, value>>, QuadraticProbing>
+          hm(2 * count, 0, 1);
+      b("HashMap<QuadraticProbing>", hm);
+    }
 
-  if (type == -1 || type == 1) {
-    HashMap<key, value, hash, std::equal_to<>,
-            huge_page_allocator<std::pair<key, value>>>
-        hm(2 * count, 0);
-    b("HashMap", hm);
-  }
+    if (type == -1 || type == 6) {
+      HashMap<key, value, hash, std::equal_to<>,
+              huge_page_allocator<std::pair<key, value>>, CacheLineProbing>
+          hm(2 * count, 0, 1);
+      b("HashMap<CacheLineProbing>", hm);
+    }
 
 #if __has_include(<google/dense_hash_map>)
-  if (type == -1 || type == 2) {
-    // Couldn't get it to work with the huge_page_allocator
-    google::dense_hash_map<key, value, hash> hm(count);
-    hm.set_empty_key(0);
-    hm.set_deleted_key(1);
-    b("google::dense_hash_map", hm);
-  }
+    if (type == -1 || type == 2) {
+      // Couldn't get it to work with the huge_page_allocator
+      google::dense_hash_map<key, value, hash> hm(count);
+      hm.set_empty_key(0);
+      hm.set_deleted_key(1);
+      b("google::dense_hash_map", hm);
+    }
 #endif
 
 #if __has_include(<absl/container/flat_hash_map.h>)
-  if (type == -1 || type == 3) {
-    absl::flat_hash_map<key, value, hash, std::equal_to<>,
-                        huge_page_allocator<std::pair<key, value>>>
-        hm;
-    hm.reserve(count);
-    b("absl::flat_hash_map", hm);
-  }
+    if (type == -1 || type == 3) {
+      absl::flat_hash_map<key, value, hash, std::equal_to<>,
+                          huge_page_allocator<std::pair<key, value>>>
+          hm;
+      hm.reserve(count);
+      b("absl::flat_hash_map", hm);
+    }
 #endif
 
-  if (type == -1 || type == 4) {
-    std::unordered_map<key, value, hash> hm;
-    hm.reserve(count);
-    b("std::unordered_map", hm);
+    if (type == -1 || type == 4) {
+      std::unordered_map<key, value, hash> hm;
+      hm.reserve(count);
+      b("std::unordered_map", hm);
+    }
+  };
+
+  if (clustered) {
+    run(IdentityHash(), ClusteredKeys());
+  } else {
+    run(Crc32Hash(), UniformKeys());
   }
 
   return 0;
@@ -0,0 +1,107 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t buckets = 1000000;
+  size_t keys = 10;
+  size_t iters = 100000;
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:k:i:t:")) != -1) {
+    switch (opt) {
+    case 'b':
+      buckets = std::stoul(optarg);
+      break;
+    case 'k':
+      keys = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc) {
+  usage:
+    std::cerr << "HashMapClearBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+                 "usage: HashMapClearBenchmark [-b buckets] [-k keys] "
+                 "[-i iters] [-t 1|2|3]\n"
+              << std::endl;
+    exit(1);
+  }
+
+  using key = size_t;
+  using value = size_t;
+
+  struct hash {
+    size_t operator()(size_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  // Simulates a scratch map reused per request: insert a few keys, look them
+  // up and clear
+  auto b = [&](const char *n, auto &m) {
+    std::minstd_rand gen(0);
+    std::uniform_int_distribution<key> ud(1, buckets);
+    std::vector<key> request(keys);
+    size_t sum = 0;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) {
+      for (auto &k : request) {
+        k = ud(gen);
+        m[k] += 1;
+      }
+      for (const auto k : request) {
+        sum += m.find(k)->second;
+      }
+      m.clear();
+    }
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(stop - start);
+    std::cout << n << ": mean " << duration.count() / iters
+              << " ns/request (checksum " << sum << ")" << std::endl;
+  };
+
+  using alloc = std::allocator<std::pair<key, value>>;
+
+  if (type == -1 || type == 1) {
+    HashMap<key, value, hash, std::equal_to<>, alloc, LinearProbing,
+            SweepClear>
+        hm(buckets, 0);
+    b("HashMap<SweepClear>", hm);
+  }
+
+  if (type == -1 || type == 2) {
+    HashMap<key, value, hash, std::equal_to<>, alloc, LinearProbing,
+            GenerationClear<>>
+        hm(buckets, 0);
+    b("HashMap<GenerationClear>", hm);
+  }
+
+  if (type == -1 || type == 3) {
+    HashMap<key, value, hash, std::equal_to<>, alloc, LinearProbing,
+            TrackedClear<>>
+        hm(buckets, 0);
+    b("HashMap<TrackedClear>", hm);
+  }
+
+  return 0;
+}
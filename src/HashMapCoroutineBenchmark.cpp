@@ -0,0 +1,119 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+#include <rigtorp/HashMapCoroutine.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t count = 1 << 24;
+  size_t iters = 10000000;
+  size_t width = 16;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:i:w:")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 'w':
+      width = std::stoul(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || count == 0 || width == 0) {
+  usage:
+    std::cerr
+        << "HashMapCoroutineBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+           "usage: HashMapCoroutineBenchmark [-c count] [-i iters] "
+           "[-w width]\n"
+        << std::endl;
+    exit(1);
+  }
+
+  struct hash {
+    size_t operator()(uint64_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  // Random keys so that the table is much larger than the last level cache
+  // and lookups miss in cache, lookups are half hits
+  HashMap<uint64_t, uint64_t, hash> hm(16, 0);
+  std::vector<uint64_t> lookups(iters);
+  {
+    std::mt19937_64 gen(0);
+    std::vector<uint64_t> keys(count);
+    for (auto &k : keys) {
+      k = gen() | 1;
+      hm.emplace(k, k);
+    }
+    for (auto &k : lookups) {
+      k = gen() % 2 ? keys[gen() % count] : gen() | 1;
+    }
+  }
+  std::cout << "table size " << (hm.bucket_count() * sizeof(uint64_t) * 2 >> 20)
+            << " MiB" << std::endl;
+
+  auto b = [&](const char *n, auto &&run) {
+    auto start = steady_clock::now();
+    const size_t hits = run();
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(stop - start);
+    std::cout << n << ": " << duration.count() / iters << " ns/lookup ("
+              << hits << " hits)" << std::endl;
+  };
+
+  b("find", [&] {
+    size_t hits = 0;
+    for (const auto k : lookups) {
+      hits += hm.find(k) != hm.end();
+    }
+    return hits;
+  });
+
+  b("batched prefetch", [&] {
+    size_t hits = 0;
+    for (size_t i = 0; i < iters; i += width) {
+      const size_t n = std::min(width, iters - i);
+      for (size_t j = 0; j < n; ++j) {
+        hm.prefetch(lookups[i + j]);
+      }
+      for (size_t j = 0; j < n; ++j) {
+        hits += hm.find(lookups[i + j]) != hm.end();
+      }
+    }
+    return hits;
+  });
+
+#ifdef RIGTORP_HASHMAP_COROUTINES
+  b("interleave_find", [&] {
+    size_t hits = 0;
+    const auto &chm = hm;
+    interleave_find(chm, lookups.begin(), lookups.end(), width,
+                    [&](uint64_t, decltype(hm)::const_iterator it) {
+                      hits += it != chm.end();
+                    });
+    return hits;
+  });
+#else
+  std::cout << "interleave_find: requires C++20 coroutines" << std::endl;
+#endif
+
+  return 0;
+}
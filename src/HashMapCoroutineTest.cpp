@@ -0,0 +1,104 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+#include <rigtorp/HashMapCoroutine.h>
+
+using namespace rigtorp;
+
+static bool ok = true;
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+    }                                                                          \
+    ok = ok && res;                                                            \
+  }(static_cast<bool>(expr)))
+
+struct Hash {
+  size_t operator()(int v) { return v * 7; }
+  size_t operator()(const std::string &v) { return std::stoi(v) * 7; }
+};
+
+struct Equal {
+  bool operator()(int lhs, int rhs) { return lhs == rhs; }
+  bool operator()(int lhs, const std::string &rhs) {
+    return lhs == std::stoi(rhs);
+  }
+};
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  {
+    // prefetch() is available without coroutines
+    HashMap<int, int, Hash, Equal> hm(16, 0);
+    hm.emplace(1, 1);
+    hm.prefetch(1);
+    hm.prefetch(2);
+    hm.prefetch("1");
+    EXPECT(hm.find(1) != hm.end());
+  }
+
+#ifdef RIGTORP_HASHMAP_COROUTINES
+  {
+    HashMap<int, int, Hash, Equal> hm(16, 0);
+    for (int i = 1; i <= 100; ++i) {
+      hm.emplace(i, i * 2);
+    }
+
+    // A lookup completes after one resume
+    auto l = co_find(hm, 1);
+    EXPECT(!l.done());
+    l.resume();
+    EXPECT(l.done());
+    auto it = l.get();
+    EXPECT(it != hm.cend() && it->second == 2);
+
+    auto miss = co_find(hm, 1000);
+    miss.resume();
+    EXPECT(miss.get() == hm.cend());
+
+    // Heterogeneous lookup
+    auto het = co_find(hm, std::string("3"));
+    het.resume();
+    EXPECT(het.get()->second == 6);
+
+    // Results are delivered in key order for any width
+    std::vector<int> keys;
+    for (int i = 1; i <= 200; ++i) {
+      keys.push_back(i);
+    }
+    for (size_t width : {1, 3, 16, 1000}) {
+      std::vector<int> found;
+      int hits = 0;
+      interleave_find(hm, keys.begin(), keys.end(), width,
+                      [&](int key, decltype(hm)::const_iterator res) {
+                        found.push_back(key);
+                        if (res != hm.cend()) {
+                          hits++;
+                          EXPECT(res->second == key * 2);
+                        }
+                      });
+      EXPECT(found == keys);
+      EXPECT(hits == 100);
+    }
+
+    // Empty input
+    int calls = 0;
+    interleave_find(hm, keys.begin(), keys.begin(), 4,
+                    [&](int, decltype(hm)::const_iterator) { calls++; });
+    EXPECT(calls == 0);
+  }
+#endif
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
@@ -0,0 +1,337 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+// Differential fuzzer comparing HashMap to std::unordered_map. Each input is
+// decoded into a sequence of operations that is applied to both maps, after
+// each operation the maps are compared and HashMap::check_invariants() is
+// checked. Maps are instantiated with adversarial hash functions, all probe
+// and clear policies and a high max load factor.
+//
+// Runs random inputs by default. Build with -DHASHMAP_LIBFUZZER and
+// -fsanitize=fuzzer to get a libFuzzer target instead:
+//
+//   clang++ -std=c++14 -g -O1 -fsanitize=fuzzer,address,undefined
+//     -DHASHMAP_LIBFUZZER -Iinclude src/HashMapFuzz.cpp -o HashMapFuzz
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <ratio>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+
+using namespace rigtorp;
+
+using key = uint32_t;
+using value = uint32_t;
+
+// Keys 0 and 1 are reserved as empty and tombstone keys
+static constexpr key first_key = 2;
+
+// Hash functions
+
+struct GoodHash {
+  size_t operator()(key v) const noexcept {
+    return static_cast<size_t>((v * 0x9E3779B97F4A7C15ull) >> 17);
+  }
+};
+
+// All keys collide
+struct ConstantHash {
+  size_t operator()(key) const noexcept { return 0; }
+};
+
+// Only 4 distinct ideal buckets
+struct LowEntropyHash {
+  size_t operator()(key v) const noexcept { return v & 3; }
+};
+
+// Ideal buckets are the last buckets of the table, so all probe sequences
+// wrap around
+struct WrapHash {
+  size_t operator()(key v) const noexcept { return ~size_t(0) - (v & 7); }
+};
+
+// Decodes operations from the input, returns zeros when exhausted
+class Input {
+public:
+  Input(const uint8_t *data, size_t size) : p_(data), end_(data + size) {}
+
+  bool empty() const noexcept { return p_ == end_; }
+
+  uint8_t byte() noexcept { return p_ == end_ ? 0 : *p_++; }
+
+  uint32_t word() noexcept {
+    uint32_t v = byte();
+    v |= static_cast<uint32_t>(byte()) << 8;
+    return v;
+  }
+
+private:
+  const uint8_t *p_;
+  const uint8_t *end_;
+};
+
+template <typename Map> class Fuzzer {
+public:
+  explicit Fuzzer(Input &in)
+      : in_(in), keys_(1 + in.byte() % 128),
+        hm_(size_t(1) << (in.byte() % 8), 0, 1) {}
+
+  // Returns false and prints the failing operation if the maps differ
+  bool run() {
+    while (!in_.empty()) {
+      const uint8_t op = in_.byte();
+      const key k = first_key + in_.word() % keys_;
+      const value v = in_.word();
+      step(op % 12, k, v);
+      if (!check_all(op % 12, k)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  void step(uint8_t op, key k, value v) {
+    switch (op) {
+    case 0:
+    case 1: {
+      const auto res = hm_.insert({k, v});
+      expect(res.second == ref_.insert({k, v}).second, "insert() inserted");
+      expect(res.first->first == k, "insert() key");
+      expect(res.first->second == ref_[k], "insert() value");
+      break;
+    }
+    case 2: {
+      const auto res = hm_.emplace(k, v);
+      expect(res.second == ref_.emplace(k, v).second, "emplace() inserted");
+      expect(res.first->second == ref_[k], "emplace() value");
+      break;
+    }
+    case 3:
+      hm_[k] = v;
+      ref_[k] = v;
+      break;
+    case 4:
+    case 5:
+      expect(hm_.erase(k) == ref_.erase(k), "erase(key)");
+      break;
+    case 6: {
+      auto it = hm_.find(k);
+      expect((it != hm_.end()) == (ref_.count(k) == 1), "find() before erase");
+      if (it != hm_.end()) {
+        hm_.erase(it);
+        ref_.erase(k);
+      }
+      break;
+    }
+    case 7: {
+      auto it = hm_.find(k);
+      auto rit = ref_.find(k);
+      expect((it != hm_.end()) == (rit != ref_.end()), "find()");
+      if (it != hm_.end() && rit != ref_.end()) {
+        expect(it->second == rit->second, "find() value");
+      }
+      expect(hm_.count(k) == ref_.count(k), "count()");
+      break;
+    }
+    case 8:
+      // Frequent enough to wrap around the GenerationClear generation
+      if (v % 2 == 0) {
+        hm_.clear();
+        ref_.clear();
+      }
+      break;
+    case 9:
+      hm_.rehash(v % 256);
+      break;
+    case 10:
+      hm_.reserve(v % 128);
+      break;
+    case 11: {
+      // Merge a small map into this map, exercising the insert path with
+      // existing tombstones
+      Map other(16, 0, 1);
+      for (key i = 0; i < v % 8; ++i) {
+        other.emplace(first_key + (k + i) % keys_, v);
+      }
+      hm_.merge_from(other, [](value &a, const value &b) { a += b; });
+      for (const auto &e : other) {
+        auto res = ref_.emplace(e.first, e.second);
+        if (!res.second) {
+          res.first->second += e.second;
+        }
+      }
+      break;
+    }
+    }
+  }
+
+  bool check_all(uint8_t op, key k) {
+    expect(hm_.check_invariants(), "check_invariants()");
+    expect(hm_.size() == ref_.size(), "size()");
+    expect(hm_.empty() == ref_.empty(), "empty()");
+    size_t n = 0;
+    for (const auto &e : hm_) {
+      auto it = ref_.find(e.first);
+      expect(it != ref_.end() && it->second == e.second, "iteration");
+      ++n;
+    }
+    expect(n == ref_.size(), "iteration count");
+    for (const auto &e : ref_) {
+      auto it = hm_.find(e.first);
+      expect(it != hm_.end() && it->second == e.second, "lookup");
+    }
+    if (!ok_) {
+      std::cerr << "after op " << static_cast<int>(op) << " key " << k
+                << " size " << ref_.size() << " buckets "
+                << hm_.bucket_count() << std::endl;
+    }
+    return ok_;
+  }
+
+  void expect(bool res, const char *what) {
+    if (!res && ok_) {
+      std::cerr << "FAILED " << what << std::endl;
+      ok_ = false;
+    }
+  }
+
+  Input &in_;
+  const key keys_;
+  Map hm_;
+  std::unordered_map<key, value> ref_;
+  bool ok_ = true;
+};
+
+template <typename Hash, typename Probe = LinearProbing,
+          typename Clear = SweepClear, typename MaxLoad = std::ratio<1, 2>>
+using map = HashMap<key, value, Hash, std::equal_to<void>,
+                    std::allocator<std::pair<key, value>>, Probe, Clear,
+                    NoHooks, MaxLoad>;
+
+template <typename Map> static bool fuzz(const uint8_t *data, size_t size) {
+  Input in(data, size);
+  return Fuzzer<Map>(in).run();
+}
+
+static constexpr size_t variants = 17;
+
+static bool fuzz_variant(size_t variant, const uint8_t *data, size_t size) {
+  switch (variant) {
+  case 0:
+    return fuzz<map<GoodHash>>(data, size);
+  case 1:
+    return fuzz<map<ConstantHash>>(data, size);
+  case 2:
+    return fuzz<map<LowEntropyHash>>(data, size);
+  case 3:
+    return fuzz<map<WrapHash>>(data, size);
+  case 4:
+    return fuzz<map<GoodHash, QuadraticProbing>>(data, size);
+  case 5:
+    return fuzz<map<ConstantHash, QuadraticProbing>>(data, size);
+  case 6:
+    return fuzz<map<WrapHash, QuadraticProbing>>(data, size);
+  case 7:
+    return fuzz<map<LowEntropyHash, CacheLineProbing>>(data, size);
+  case 8:
+    return fuzz<map<WrapHash, CacheLineProbing>>(data, size);
+  case 9:
+    return fuzz<map<LowEntropyHash, LinearProbing, GenerationClear<>>>(data,
+                                                                       size);
+  case 10:
+    return fuzz<map<WrapHash, LinearProbing, GenerationClear<>>>(data, size);
+  case 11:
+    return fuzz<map<LowEntropyHash, QuadraticProbing, GenerationClear<>>>(
+        data, size);
+  case 12:
+    return fuzz<map<LowEntropyHash, LinearProbing, TrackedClear<4>>>(data,
+                                                                     size);
+  case 13:
+    return fuzz<map<WrapHash, CacheLineProbing, TrackedClear<4>>>(data, size);
+  case 14:
+    return fuzz<map<ConstantHash, LinearProbing, TrackedClear<4>>>(data, size);
+  case 15:
+    return fuzz<map<WrapHash, LinearProbing, SweepClear, std::ratio<7, 8>>>(
+        data, size);
+  case 16:
+    return fuzz<
+        map<LowEntropyHash, QuadraticProbing, SweepClear, std::ratio<7, 8>>>(
+        data, size);
+  }
+  return true;
+}
+
+#ifdef HASHMAP_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (!fuzz_variant(data[0] % variants, data + 1, size - 1)) {
+    abort();
+  }
+  return 0;
+}
+
+#else
+
+int main(int argc, char *argv[]) {
+  size_t iters = 100;
+  size_t ops = 10000;
+  unsigned long seed = std::random_device()();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:n:s:")) != -1) {
+    switch (opt) {
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 'n':
+      ops = std::stoul(optarg);
+      break;
+    case 's':
+      seed = std::stoul(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc) {
+  usage:
+    std::cerr << "HashMapFuzz © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+                 "usage: HashMapFuzz [-i iters] [-n ops] [-s seed]\n"
+              << std::endl;
+    exit(1);
+  }
+
+  std::cout << "seed " << seed << std::endl;
+  std::mt19937_64 gen(seed);
+  // Each operation is 5 bytes, plus 2 bytes of map parameters
+  std::vector<uint8_t> data(2 + 5 * ops);
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto &b : data) {
+      b = static_cast<uint8_t>(gen());
+    }
+    for (size_t variant = 0; variant < variants; ++variant) {
+      if (!fuzz_variant(variant, data.data(), data.size())) {
+        std::cerr << "FAILED! seed " << seed << " iteration " << i
+                  << " variant " << variant << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+#endif
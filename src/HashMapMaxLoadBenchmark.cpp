@@ -0,0 +1,124 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <ratio>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  // Bytes per item depend on where the count falls between powers of two, so
+  // report several counts
+  std::vector<size_t> counts = {1000000, 1500000, 2500000, 3500000, 5000000,
+                                7000000, 10000000};
+  size_t iters = 10000000;
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:i:t:")) != -1) {
+    switch (opt) {
+    case 'c':
+      counts = {std::stoul(optarg)};
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || counts[0] == 0 || counts[0] > 0xfffffffe) {
+  usage:
+    std::cerr
+        << "HashMapMaxLoadBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+           "usage: HashMapMaxLoadBenchmark [-c count] [-i iters] [-t 1|2|3]\n"
+        << std::endl;
+    exit(1);
+  }
+
+  struct hash {
+    size_t operator()(uint64_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  for (const size_t count : counts) {
+    std::cout << count << " items:" << std::endl;
+    // Keys are a random sample of 32 bit integers, lookups are half hits
+    std::vector<uint32_t> keys(count);
+    std::vector<uint32_t> lookups(iters);
+    {
+      std::mt19937 gen(0);
+      std::uniform_int_distribution<uint32_t> ud(1, 0xffffffff);
+      for (auto &k : keys) {
+        k = ud(gen);
+      }
+      for (auto &k : lookups) {
+        k = gen() % 2 ? keys[gen() % count] : ud(gen);
+      }
+    }
+
+    auto b = [&](const char *n, auto &m, size_t bucket_size, auto &&insert,
+                 auto &&find) {
+      auto start = steady_clock::now();
+      for (const auto k : keys) {
+        insert(k);
+      }
+      auto stop = steady_clock::now();
+      const auto insert_ns = duration_cast<nanoseconds>(stop - start).count();
+      size_t hits = 0;
+      start = steady_clock::now();
+      for (const auto k : lookups) {
+        hits += find(k);
+      }
+      stop = steady_clock::now();
+      const auto find_ns = duration_cast<nanoseconds>(stop - start).count();
+      std::cout << "  " << n << ": "
+                << static_cast<double>(m.bucket_count() * bucket_size) /
+                       m.size()
+                << " bytes/item, " << insert_ns / count << " ns/insert, "
+                << find_ns / iters << " ns/lookup (" << hits << " hits)"
+                << std::endl;
+    };
+
+    if (type == -1 || type == 1) {
+      HashMap<uint64_t, uint64_t, hash> hm(16, 0);
+      b("HashMap<uint64_t, uint64_t>", hm,
+        sizeof(std::pair<uint64_t, uint64_t>),
+        [&](uint32_t k) { hm.emplace(k, k); },
+        [&](uint32_t k) { return hm.find(k) != hm.end(); });
+    }
+
+    if (type == -1 || type == 2) {
+      HashMap<uint32_t, uint32_t, hash> hm(16, 0);
+      b("HashMap<uint32_t, uint32_t>", hm,
+        sizeof(std::pair<uint32_t, uint32_t>),
+        [&](uint32_t k) { hm.emplace(k, k); },
+        [&](uint32_t k) { return hm.find(k) != hm.end(); });
+    }
+
+    if (type == -1 || type == 3) {
+      HashMap<uint32_t, uint32_t, hash, std::equal_to<void>,
+              std::allocator<std::pair<uint32_t, uint32_t>>, LinearProbing,
+              SweepClear, NoHooks, std::ratio<3, 4>>
+          hm(16, 0);
+      b("HashMap<uint32_t, uint32_t, ..., std::ratio<3, 4>>", hm,
+        sizeof(std::pair<uint32_t, uint32_t>),
+        [&](uint32_t k) { hm.emplace(k, k); },
+        [&](uint32_t k) { return hm.find(k) != hm.end(); });
+    }
+  }
+
+  return 0;
+}
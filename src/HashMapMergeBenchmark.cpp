@@ -0,0 +1,133 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t keys = 1000000;
+  size_t count = 1000000;
+  unsigned parts = 8;
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "k:c:p:t:")) != -1) {
+    switch (opt) {
+    case 'k':
+      keys = std::stoul(optarg);
+      break;
+    case 'c':
+      count = std::stoul(optarg);
+      break;
+    case 'p':
+      parts = std::stoul(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || parts == 0) {
+  usage:
+    std::cerr << "HashMapMergeBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+                 "usage: HashMapMergeBenchmark [-k keys] [-c count per part] "
+                 "[-p parts] [-t 1|2|3]\n"
+              << std::endl;
+    exit(1);
+  }
+
+  using key = uint64_t;
+  using value = uint64_t;
+
+  struct hash {
+    size_t operator()(uint64_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  using map = HashMap<key, value, hash>;
+  auto sum = [](value &a, value b) { a += b; };
+
+  // Builds per thread partial aggregations counting random keys
+  auto partials = [&]() {
+    std::vector<map> res;
+    for (unsigned p = 0; p < parts; ++p) {
+      std::minstd_rand gen(p);
+      std::uniform_int_distribution<key> ud(1, keys);
+      res.emplace_back(16, 0);
+      for (size_t i = 0; i < count; ++i) {
+        res.back()[ud(gen)]++;
+      }
+    }
+    return res;
+  };
+
+  auto b = [&](const char *n, auto &&reduce) {
+    auto maps = partials();
+    auto start = steady_clock::now();
+    const map &res = reduce(maps);
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<microseconds>(stop - start);
+    size_t total = 0;
+    for (const auto &e : res) {
+      total += e.second;
+    }
+    std::cout << n << ": " << duration.count() << " us, " << res.size()
+              << " keys, " << total << " total" << std::endl;
+  };
+
+  if (type == -1 || type == 1) {
+    b("insert loop", [&](std::vector<map> &maps) -> map & {
+      for (unsigned p = 1; p < parts; ++p) {
+        for (const auto &e : maps[p]) {
+          auto res = maps[0].insert(e);
+          if (!res.second) {
+            res.first->second += e.second;
+          }
+        }
+      }
+      return maps[0];
+    });
+  }
+
+  if (type == -1 || type == 2) {
+    b("merge", [&](std::vector<map> &maps) -> map & {
+      for (unsigned p = 1; p < parts; ++p) {
+        maps[0].merge(std::move(maps[p]), sum);
+      }
+      return maps[0];
+    });
+  }
+
+  if (type == -1 || type == 3) {
+    // Parallel tree reduction, each level merges pairs of maps in parallel
+    b("parallel tree merge", [&](std::vector<map> &maps) -> map & {
+      for (size_t stride = 1; stride < maps.size(); stride *= 2) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i + stride < maps.size(); i += 2 * stride) {
+          threads.emplace_back([&, i, stride] {
+            maps[i].merge(std::move(maps[i + stride]), sum);
+          });
+        }
+        for (auto &t : threads) {
+          t.join();
+        }
+      }
+      return maps[0];
+    });
+  }
+
+  return 0;
+}
@@ -0,0 +1,164 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#if __has_include(<google/dense_hash_map>)
+#include <google/dense_hash_map>
+#endif
+
+#if __has_include(<absl/container/flat_hash_map.h>)
+#include <absl/container/flat_hash_map.h>
+#endif
+
+#include <rigtorp/HashMap.h>
+#include <rigtorp/HashMapTrace.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t bucket_count = 16;
+  uint64_t empty_key = std::numeric_limits<uint64_t>::max();
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:e:t:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bucket_count = std::stoul(optarg);
+      break;
+    case 'e':
+      empty_key = std::stoull(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind + 1 != argc) {
+  usage:
+    std::cerr << "HashMapReplay © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+                 "usage: HashMapReplay [-b bucket_count] [-e empty_key] "
+                 "[-t 1|2|3|4] trace\n"
+              << std::endl;
+    exit(1);
+  }
+
+  // Load the whole trace up front to keep I/O out of the measurements
+  std::vector<TraceEvent> events;
+  size_t skipped = 0;
+  {
+    std::ifstream is(argv[optind], std::ios::binary);
+    if (!is) {
+      std::cerr << "failed to open " << argv[optind] << std::endl;
+      exit(1);
+    }
+    TraceReader reader(is);
+    TraceEvent ev;
+    while (reader.next(ev)) {
+      // Keys reserved by the maps can't be replayed
+      if (ev.key == empty_key || ev.key == empty_key - 1) {
+        skipped++;
+        continue;
+      }
+      events.push_back(ev);
+    }
+  }
+  if (events.empty()) {
+    std::cerr << "empty trace" << std::endl;
+    exit(1);
+  }
+  std::cout << events.size() << " events, " << skipped << " skipped"
+            << std::endl;
+
+  using key = uint64_t;
+  struct value {
+    char buf[24];
+  };
+
+  struct hash {
+    size_t operator()(size_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  std::vector<nanoseconds> latencies(events.size());
+
+  auto r = [&](const char *n, auto &m) {
+    size_t hits = 0;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < events.size(); ++i) {
+      const auto &ev = events[i];
+      auto op_start = steady_clock::now();
+      switch (ev.op) {
+      case TraceOp::find:
+        hits += m.find(ev.key) != m.end();
+        break;
+      case TraceOp::insert:
+        hits += !m.insert({ev.key, {}}).second;
+        break;
+      case TraceOp::erase:
+        hits += m.erase(ev.key);
+        break;
+      }
+      latencies[i] = steady_clock::now() - op_start;
+    }
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(stop - start);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) {
+      return latencies[std::min(latencies.size() - 1,
+                                static_cast<size_t>(p * latencies.size()))]
+          .count();
+    };
+
+    std::cout << n << ": " << duration.count() / events.size() << " ns/op, "
+              << events.size() * 1000 / std::max<int64_t>(duration.count(), 1)
+              << " Mops/s, p50 " << pct(0.5) << " p90 " << pct(0.9) << " p99 "
+              << pct(0.99) << " p99.9 " << pct(0.999) << " max "
+              << latencies.back().count() << " ns/op, " << hits << " hits, "
+              << m.size() << " final size" << std::endl;
+  };
+
+  if (type == -1 || type == 1) {
+    HashMap<key, value, hash, std::equal_to<>> hm(bucket_count, empty_key);
+    r("HashMap", hm);
+  }
+
+#if __has_include(<google/dense_hash_map>)
+  if (type == -1 || type == 2) {
+    google::dense_hash_map<key, value, hash> hm(bucket_count);
+    hm.set_empty_key(empty_key);
+    hm.set_deleted_key(empty_key - 1);
+    r("google::dense_hash_map", hm);
+  }
+#endif
+
+#if __has_include(<absl/container/flat_hash_map.h>)
+  if (type == -1 || type == 3) {
+    absl::flat_hash_map<key, value, hash, std::equal_to<>> hm;
+    hm.reserve(bucket_count);
+    r("absl::flat_hash_map", hm);
+  }
+#endif
+
+  if (type == -1 || type == 4) {
+    std::unordered_map<key, value, hash> hm;
+    hm.reserve(bucket_count);
+    r("std::unordered_map", hm);
+  }
+
+  return 0;
+}
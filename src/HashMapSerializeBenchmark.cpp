@@ -0,0 +1,119 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+#include <rigtorp/HashMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+// Writer and reader over an in memory buffer
+struct StringWriter {
+  void write(const char *data, size_t n) { buf.append(data, n); }
+  std::string buf;
+};
+
+struct StringReader {
+  bool read(char *data, size_t n) {
+    if (buf.size() - pos < n) {
+      return false;
+    }
+    std::memcpy(data, buf.data() + pos, n);
+    pos += n;
+    return true;
+  }
+  const std::string &buf;
+  size_t pos = 0;
+};
+
+int main(int argc, char *argv[]) {
+  size_t count = 1000000;
+  size_t range = 4000000;
+  int iters = 10;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:r:i:")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = std::stoul(optarg);
+      break;
+    case 'r':
+      range = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || iters <= 0) {
+  usage:
+    std::cerr
+        << "HashMapSerializeBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+           "usage: HashMapSerializeBenchmark [-c count] [-r key range] "
+           "[-i iters]\n"
+        << std::endl;
+    exit(1);
+  }
+
+  using key = uint64_t;
+  using value = uint32_t;
+
+  struct hash {
+    size_t operator()(uint64_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  using map = HashMap<key, value, hash>;
+  map hm(16, 0);
+  {
+    std::minstd_rand gen(0);
+    std::uniform_int_distribution<key> ud(1, range);
+    while (hm.size() < count) {
+      hm.emplace(ud(gen), 1);
+    }
+  }
+  std::cout << "bucket array: " << hm.bucket_count() * sizeof(map::value_type)
+            << " bytes" << std::endl;
+
+  auto b = [&](const char *n, KeyEncoding encoding) {
+    StringWriter w;
+    auto start = steady_clock::now();
+    for (int i = 0; i < iters; ++i) {
+      w.buf.clear();
+      hm.serialize(w, encoding);
+    }
+    auto stop = steady_clock::now();
+    auto write = duration_cast<nanoseconds>(stop - start) / iters;
+
+    map hm2(16, 0);
+    start = steady_clock::now();
+    for (int i = 0; i < iters; ++i) {
+      StringReader r{w.buf};
+      hm2.deserialize(r);
+    }
+    stop = steady_clock::now();
+    auto read = duration_cast<nanoseconds>(stop - start) / iters;
+
+    std::cout << n << ": " << w.buf.size() << " bytes ("
+              << static_cast<double>(w.buf.size()) / count
+              << " bytes/item), write " << write.count() / count
+              << " ns/item, load " << read.count() / count << " ns/item"
+              << std::endl;
+  };
+
+  b("raw", KeyEncoding::raw);
+  b("varint", KeyEncoding::varint);
+  b("delta", KeyEncoding::delta);
+
+  return 0;
+}
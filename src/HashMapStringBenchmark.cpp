@@ -0,0 +1,127 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t count = 100000;
+  size_t iters = 10000000;
+  double hit_ratio = 0.95;
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:i:h:t:")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 'h':
+      hit_ratio = std::stod(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc) {
+  usage:
+    std::cerr << "HashMapStringBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+                 "usage: HashMapStringBenchmark [-c count] [-i iters] "
+                 "[-h hit ratio] [-t 1|2|3]\n"
+              << std::endl;
+    exit(1);
+  }
+
+  // Transparent hash, std::string converts to std::string_view
+  struct hash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view s) const noexcept {
+      return std::hash<std::string_view>()(s);
+    }
+  };
+
+  // Keys are longer than the small string optimization buffer, constructing
+  // a std::string allocates
+  auto make_key = [](size_t i) {
+    return "user:session:" + std::to_string(1000000000 + i);
+  };
+
+  // Pre-generate the input so that only the upserts are measured
+  std::vector<std::string> storage;
+  for (size_t i = 0; i < count; ++i) {
+    storage.push_back(make_key(i));
+  }
+  std::vector<std::string_view> input;
+  {
+    std::minstd_rand gen(0);
+    std::uniform_int_distribution<size_t> ud(0, count - 1);
+    std::bernoulli_distribution hit(hit_ratio);
+    std::vector<size_t> idx;
+    size_t fresh = count;
+    for (size_t i = 0; i < iters; ++i) {
+      if (hit(gen)) {
+        idx.push_back(ud(gen));
+      } else {
+        idx.push_back(storage.size());
+        storage.push_back(make_key(fresh++));
+      }
+    }
+    for (auto i : idx) {
+      input.push_back(storage[i]);
+    }
+  }
+
+  auto b = [&](const char *n, auto &m, auto &&upsert) {
+    for (size_t i = 0; i < count; ++i) {
+      m.emplace(storage[i], 0);
+    }
+    auto start = steady_clock::now();
+    for (const auto &k : input) {
+      upsert(m, k);
+    }
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(stop - start);
+    std::cout << n << ": mean " << duration.count() / iters << " ns/iter"
+              << std::endl;
+  };
+
+  if (type == -1 || type == 1) {
+    HashMap<std::string, size_t, hash, std::equal_to<>> hm(2 * count, "");
+    b("HashMap operator[](std::string(k))", hm,
+      [](auto &m, std::string_view k) { m[std::string(k)] += 1; });
+  }
+
+  if (type == -1 || type == 2) {
+    HashMap<std::string, size_t, hash, std::equal_to<>> hm(2 * count, "");
+    b("HashMap operator[](k)", hm,
+      [](auto &m, std::string_view k) { m[k] += 1; });
+  }
+
+  if (type == -1 || type == 3) {
+    std::unordered_map<std::string, size_t, hash> hm;
+    hm.reserve(count);
+    b("std::unordered_map operator[](std::string(k))", hm,
+      [](auto &m, std::string_view k) { m[std::string(k)] += 1; });
+  }
+
+  return 0;
+}
@@ -3,7 +3,11 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <random>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 
 #include <rigtorp/HashMap.h>
 
@@ -28,6 +32,11 @@ static bool ok = true;
     return false;                                                              \
   }())
 
+// Maps all keys to few buckets to force long probe sequences
+struct BadHash {
+  size_t operator()(int v) { return v & 3; }
+};
+
 struct Hash {
   size_t operator()(int v) { return v * 7; }
   size_t operator()(const std::string &v) { return std::stoi(v) * 7; }
@@ -40,6 +49,126 @@ struct Equal {
   }
 };
 
+// Hash for using const char * as lookup key for std::string keys
+struct StringHash {
+  using is_transparent = void;
+
+  size_t operator()(const std::string &v) {
+    return std::hash<std::string>()(v);
+  }
+  size_t operator()(const char *v) { return std::hash<std::string>()(v); }
+};
+
+// Key counting conversions from int lookup keys
+struct CountedKey {
+  CountedKey() = default;
+  CountedKey(int v) : v(v) { conversions++; }
+  bool operator==(const CountedKey &other) const { return v == other.v; }
+
+  int v = 0;
+  static int conversions;
+};
+
+int CountedKey::conversions = 0;
+
+struct CountedHash {
+  using is_transparent = void;
+
+  size_t operator()(const CountedKey &k) const { return k.v; }
+  size_t operator()(int v) const { return v; }
+};
+
+struct CountedEqual {
+  using is_transparent = void;
+
+  bool operator()(const CountedKey &lhs, const CountedKey &rhs) const {
+    return lhs.v == rhs.v;
+  }
+  bool operator()(const CountedKey &lhs, int rhs) const { return lhs.v == rhs; }
+  bool operator()(int lhs, const CountedKey &rhs) const { return lhs == rhs.v; }
+};
+
+// Records hook calls
+struct RecordingHooks : NoHooks {
+  static constexpr size_t probe_threshold = 4;
+  static constexpr size_t backshift_threshold = 4;
+  static constexpr bool trace_rehash = true;
+
+  void on_rehash_begin(size_t, size_t size) {
+    rehash_begin++;
+    rehash_size = size;
+  }
+  void on_rehash_end(size_t bucket_count,
+                     std::chrono::steady_clock::duration duration) {
+    rehash_end++;
+    rehash_bucket_count = bucket_count;
+    rehash_duration = duration;
+  }
+  void on_long_probe(size_t hash, size_t length) {
+    long_probes++;
+    probe_hash = hash;
+    probe_length = length;
+  }
+  void on_long_backshift(size_t hash, size_t length) {
+    long_backshifts++;
+    backshift_hash = hash;
+    backshift_length = length;
+  }
+
+  int rehash_begin = 0, rehash_end = 0, long_probes = 0, long_backshifts = 0;
+  size_t rehash_size = 0, rehash_bucket_count = 0;
+  std::chrono::steady_clock::duration rehash_duration{-1};
+  size_t probe_hash = 0, probe_length = 0;
+  size_t backshift_hash = 0, backshift_length = 0;
+};
+
+// Counts copies of the hooks
+struct CopyCountingHooks : RecordingHooks {
+  CopyCountingHooks() = default;
+  CopyCountingHooks(const CopyCountingHooks &other) : RecordingHooks(other) {
+    copies++;
+  }
+  CopyCountingHooks(CopyCountingHooks &&) = default;
+  CopyCountingHooks &operator=(const CopyCountingHooks &other) {
+    RecordingHooks::operator=(other);
+    copies++;
+    return *this;
+  }
+  CopyCountingHooks &operator=(CopyCountingHooks &&) = default;
+
+  static int copies;
+};
+
+int CopyCountingHooks::copies = 0;
+
+// Applies random emplaces, erases and occasional clears to hm and
+// std::unordered_map and compares them
+template <typename Map> static void random_compare(Map &hm) {
+  std::unordered_map<int, int> ref;
+  std::minstd_rand gen(0);
+  std::uniform_int_distribution<int> kd(1, 256);
+  for (int i = 0; i < 20000; ++i) {
+    const int key = kd(gen);
+    if (i % 4096 == 4095) {
+      hm.clear();
+      ref.clear();
+    } else if (gen() % 2) {
+      EXPECT(hm.erase(key) == ref.erase(key));
+    } else {
+      EXPECT(hm.emplace(key, i).second == ref.emplace(key, i).second);
+    }
+    EXPECT(hm.size() == ref.size());
+  }
+  for (int key = 1; key <= 256; ++key) {
+    auto it = hm.find(key);
+    EXPECT(hm.count(key) == ref.count(key));
+    EXPECT(it == hm.end() || it->second == ref[key]);
+  }
+  EXPECT(static_cast<size_t>(std::distance(hm.begin(), hm.end())) ==
+         ref.size());
+  EXPECT(hm.check_invariants());
+}
+
 int main(int argc, char *argv[]) {
   (void)argc, (void)argv;
 
@@ -85,6 +214,9 @@ int main(int argc, char *argv[]) {
     static_assert(std::is_same<decltype(hm.emplace(1, 1)),
                                std::pair<decltype(hm)::iterator, bool>>::value,
                   "");
+    static_assert(std::is_same<decltype(hm.try_emplace(1, 1)),
+                               std::pair<decltype(hm)::iterator, bool>>::value,
+                  "");
     static_assert(std::is_same<decltype(hm.erase(hm.begin())), void>::value,
                   "");
     static_assert(std::is_same<decltype(hm.erase(1)), size_t>::value, "");
@@ -133,6 +265,30 @@ int main(int argc, char *argv[]) {
     static_assert(std::is_same<decltype(chm.max_bucket_count()), size_t>::value,
                   "");
 
+    // bucket_size()
+    static_assert(std::is_same<decltype(hm.bucket_size(0)), size_t>::value,
+                  "");
+
+    // Local iterators
+    static_assert(std::is_same<decltype(hm.begin(0)),
+                               decltype(hm)::local_iterator>::value,
+                  "");
+    static_assert(std::is_same<decltype(chm.begin(0)),
+                               decltype(hm)::const_local_iterator>::value,
+                  "");
+    static_assert(std::is_same<decltype(hm.cbegin(0)),
+                               decltype(hm)::const_local_iterator>::value,
+                  "");
+    static_assert(
+        std::is_same<decltype(hm.end(0)), decltype(hm)::local_iterator>::value,
+        "");
+    static_assert(std::is_same<decltype(chm.end(0)),
+                               decltype(hm)::const_local_iterator>::value,
+                  "");
+    static_assert(std::is_same<decltype(hm.cend(0)),
+                               decltype(hm)::const_local_iterator>::value,
+                  "");
+
     // Hash policy
 
     // rehash()
@@ -307,6 +463,63 @@ int main(int argc, char *argv[]) {
     EXPECT(!res2.second);
   }
 
+  {
+    // try_emplace()
+    HashMap<int, int> hm(16, 0);
+    auto res = hm.try_emplace(1, 1);
+    EXPECT(hm.size() == 1);
+    EXPECT(res.first->first == 1);
+    EXPECT(res.first->second == 1);
+    EXPECT(res.second);
+    auto res2 = hm.try_emplace(1, 2);
+    EXPECT(hm.size() == 1);
+    EXPECT(res2.first == res.first);
+    EXPECT(res2.first->second == 1);
+    EXPECT(!res2.second);
+  }
+
+  {
+    // template <class K> try_emplace(const K&)
+    HashMap<std::string, int, StringHash, std::equal_to<>> hm(16, "");
+    auto res = hm.try_emplace("a", 1);
+    EXPECT(hm.size() == 1);
+    EXPECT(res.first->first == "a");
+    EXPECT(res.first->second == 1);
+    EXPECT(res.second);
+    auto res2 = hm.try_emplace("a", 2);
+    EXPECT(hm.size() == 1);
+    EXPECT(res2.first == res.first);
+    EXPECT(res2.first->second == 1);
+    EXPECT(!res2.second);
+  }
+
+  {
+    // Related key types only construct a key_type when inserting
+    HashMap<CountedKey, int, CountedHash, CountedEqual> hm(16, CountedKey());
+    CountedKey::conversions = 0;
+    EXPECT(hm.try_emplace(1, 1).second);
+    EXPECT(CountedKey::conversions == 1);
+    EXPECT(!hm.try_emplace(1, 2).second);
+    hm[1] += 1;
+    EXPECT(CountedKey::conversions == 1);
+    hm[2] = 1;
+    EXPECT(CountedKey::conversions == 2);
+    EXPECT(hm.size() == 2);
+    EXPECT(hm[1] == 2);
+    EXPECT(CountedKey::conversions == 2);
+  }
+
+  {
+    // Related key types are converted without transparent Hash and KeyEqual
+    HashMap<CountedKey, int, CountedHash, std::equal_to<CountedKey>> hm(
+        16, CountedKey());
+    CountedKey::conversions = 0;
+    hm[1] = 1;
+    hm[1] += 1;
+    EXPECT(CountedKey::conversions == 2);
+    EXPECT(hm.size() == 1);
+  }
+
   {
     // erase(iterator)
     HashMap<int, int> hm(16, 0);
@@ -398,6 +611,17 @@ int main(int argc, char *argv[]) {
     EXPECT(hm[1] == 1);
   }
 
+  {
+    // template <class K> operator[](const K&)
+    HashMap<std::string, int, StringHash, std::equal_to<>> hm(16, "");
+    static_assert(std::is_same<decltype(hm["a"]), int &>::value, "");
+    hm["a"] = 1;
+    hm["a"] += 1;
+    EXPECT(hm.size() == 1);
+    EXPECT(hm["a"] == 2);
+    EXPECT(hm.at(std::string("a")) == 2);
+  }
+
   {
     // count(const key_type&)
     HashMap<int, int> hm(16, 0);
@@ -483,6 +707,30 @@ int main(int argc, char *argv[]) {
     EXPECT(chm.max_bucket_count() > 0);
   }
 
+  {
+    // bucket_size() and local iterators
+    using alloc = std::allocator<std::pair<int, int>>;
+    HashMap<int, int, BadHash, Equal, alloc, QuadraticProbing> hm(16, 0, -1);
+    const auto &chm = hm;
+    hm.emplace(4, 4);
+    hm.emplace(8, 8);
+    hm.emplace(12, 12);
+    hm.erase(8);
+    size_t n = 0;
+    for (size_t i = 0; i < hm.bucket_count(); ++i) {
+      EXPECT(hm.bucket_size(i) <= 1);
+      EXPECT(hm.end(i) - hm.begin(i) ==
+             static_cast<std::ptrdiff_t>(hm.bucket_size(i)));
+      EXPECT(chm.cend(i) - chm.cbegin(i) ==
+             static_cast<std::ptrdiff_t>(hm.bucket_size(i)));
+      for (auto it = hm.begin(i); it != hm.end(i); ++it) {
+        EXPECT(&*hm.find(it->first) == it);
+        ++n;
+      }
+    }
+    EXPECT(n == 2);
+  }
+
   // Hash policy
   {
     HashMap<int, int> hm(2, 0);
@@ -505,6 +753,418 @@ int main(int argc, char *argv[]) {
     EXPECT(chm.bucket_count() == 32);
   }
 
+  // Merge
+  {
+    auto sum = [](int &a, int b) { a += b; };
+    HashMap<int, int> hm1(16, 0);
+    HashMap<int, int> hm2(4, 0);
+    for (int i = 1; i <= 10; ++i) {
+      hm1.emplace(i, i);
+    }
+    for (int i = 6; i <= 20; ++i) {
+      hm2.emplace(i, 100);
+    }
+    hm1.merge_from(hm2, sum);
+    EXPECT(hm1.size() == 20);
+    EXPECT(hm2.size() == 15);
+    EXPECT(hm1.at(1) == 1);
+    EXPECT(hm1.at(6) == 106);
+    EXPECT(hm1.at(10) == 110);
+    EXPECT(hm1.at(20) == 100);
+    EXPECT(hm1.bucket_count() == 64);
+  }
+
+  {
+    // merge() moves values and leaves other empty
+    HashMap<int, std::string> hm1(4, 0);
+    HashMap<int, std::string> hm2(64, 0);
+    hm1.emplace(1, "a");
+    hm2.emplace(1, "b");
+    hm2.emplace(2, "c");
+    hm1.merge(std::move(hm2),
+              [](std::string &a, std::string &&b) { a += std::move(b); });
+    EXPECT(hm1.size() == 2);
+    EXPECT(hm1.at(1) == "ab");
+    EXPECT(hm1.at(2) == "c");
+    EXPECT(hm2.empty());
+    EXPECT(hm2.begin() == hm2.end());
+  }
+
+  {
+    // Merge into a map with tombstones
+    HashMap<int, int, Hash, Equal, std::allocator<std::pair<int, int>>,
+            QuadraticProbing>
+        hm1(16, 0, -1), hm2(16, 0, -1);
+    for (int i = 1; i <= 7; ++i) {
+      hm1.emplace(i, i);
+    }
+    for (int i = 1; i <= 6; ++i) {
+      hm1.erase(i);
+    }
+    for (int i = 1; i <= 7; ++i) {
+      hm2.emplace(i, i);
+    }
+    hm1.merge_from(hm2, [](int &a, int b) { a += b; });
+    EXPECT(hm1.size() == 7);
+    EXPECT(hm1.bucket_count() == 16);
+    EXPECT(hm1.at(1) == 1);
+    EXPECT(hm1.at(7) == 14);
+  }
+
+  // Serialization
+  {
+    for (auto encoding :
+         {KeyEncoding::raw, KeyEncoding::varint, KeyEncoding::delta}) {
+      HashMap<int, double> hm1(16, 0);
+      for (int i = -5000; i <= 5000; i += 3) {
+        if (i != 0) {
+          hm1.emplace(i, i * 0.5);
+        }
+      }
+      std::stringstream ss;
+      hm1.serialize(ss, encoding);
+      hm1.serialize(ss, encoding);
+      HashMap<int, double> hm2(16, 0);
+      hm2.emplace(2, 1.0);
+      hm2.deserialize(ss);
+      EXPECT(hm2.size() == hm1.size());
+      EXPECT(hm2.count(2) == 0);
+      bool equal = true;
+      for (const auto &e : hm1) {
+        auto it = hm2.find(e.first);
+        equal = equal && it != hm2.end() && it->second == e.second;
+      }
+      EXPECT(equal);
+      // Doesn't read past the end of the first map
+      HashMap<int, double> hm3(16, 0);
+      hm3.deserialize(ss);
+      EXPECT(hm3.size() == hm1.size());
+      EXPECT(ss.peek() == EOF);
+    }
+  }
+
+  {
+    // Empty map
+    HashMap<int, int> hm1(16, 0), hm2(16, 0);
+    std::stringstream ss;
+    hm1.serialize(ss, KeyEncoding::delta);
+    hm2.emplace(1, 1);
+    hm2.deserialize(ss);
+    EXPECT(hm2.empty());
+  }
+
+  {
+    // Malformed input
+    HashMap<int, int> hm1(16, 0), hm2(16, 0);
+    for (int i = 1; i <= 100; ++i) {
+      hm1.emplace(i, i);
+    }
+    std::stringstream ss;
+    hm1.serialize(ss, KeyEncoding::varint);
+    const std::string data = ss.str();
+    // The map is unchanged if reading fails
+    hm2.emplace(1000, 1);
+    bool unchanged = true;
+    for (size_t n = 0; n < data.size(); ++n) {
+      std::stringstream truncated(data.substr(0, n));
+      EXPECT(THROWS(hm2.deserialize(truncated)));
+      unchanged = unchanged && hm2.size() == 1 && hm2.at(1000) == 1;
+    }
+    EXPECT(unchanged);
+    // The item count isn't trusted for allocating the map
+    std::string huge_count("HMAP\x01\x00\x04\x04", 8);
+    huge_count += std::string(7, '\xff') + '\x7f';
+    huge_count += '\x00';
+    std::stringstream huge(huge_count);
+    bool runtime_error = false;
+    try {
+      hm2.deserialize(huge);
+    } catch (const std::runtime_error &) {
+      runtime_error = true;
+    }
+    EXPECT(runtime_error);
+    EXPECT(hm2.bucket_count() == 16);
+    std::stringstream bad_magic("XMAP" + data.substr(4));
+    EXPECT(THROWS(hm2.deserialize(bad_magic)));
+    HashMap<int64_t, int> hm3(16, 0);
+    std::stringstream bad_type(data);
+    EXPECT(THROWS(hm3.deserialize(bad_type)));
+    HashMap<double, int> hm4(16, 0);
+    EXPECT(THROWS(hm4.serialize(ss, KeyEncoding::varint)));
+  }
+
+  // Probe policies
+  {
+    // CacheLineProbing probes the buckets in the cache line of the ideal
+    // bucket first, also if the buckets aren't cache line aligned
+    using value = std::pair<int, int>;
+    alignas(64) value buckets[64];
+    for (size_t shift = 0; shift < 8; ++shift) {
+      const value *base = buckets + shift;
+      const size_t mask = 32 - 1;
+      const size_t offset = CacheLineProbing::offset(base);
+      auto line = [&](size_t idx) {
+        return reinterpret_cast<uintptr_t>(base + idx) / 64;
+      };
+      for (size_t idx = 0; idx <= mask; ++idx) {
+        // The first and last lines of the table are partial
+        if (line(idx) == line(0) || line(idx) == line(mask)) {
+          continue;
+        }
+        size_t probe = idx;
+        for (size_t n = 1; n < 8; ++n) {
+          probe = CacheLineProbing::next<value>(probe, n, mask, offset);
+          EXPECT(line(probe) == line(idx));
+        }
+        probe = CacheLineProbing::next<value>(probe, 8, mask, offset);
+        EXPECT(line(probe) != line(idx));
+      }
+    }
+  }
+
+  {
+    // Tombstones are reused and removed on rehash
+    HashMap<int, int, Hash, Equal, std::allocator<std::pair<int, int>>,
+            QuadraticProbing>
+        hm(16, 0, -1);
+    for (int i = 1; i <= 7; ++i) {
+      hm.emplace(i, i);
+    }
+    EXPECT(hm.bucket_count() == 16);
+    EXPECT(hm.erase(1) == 1);
+    EXPECT(hm.erase(1) == 0);
+    EXPECT(hm.find(1) == hm.end());
+    EXPECT(hm.size() == 6);
+    EXPECT(std::distance(hm.begin(), hm.end()) == 6);
+    hm.emplace(1, 1);
+    EXPECT(hm.bucket_count() == 16);
+    EXPECT(hm.at(1) == 1);
+    for (int i = 1; i <= 7; ++i) {
+      hm.erase(i);
+    }
+    EXPECT(hm.empty());
+    EXPECT(hm.begin() == hm.end());
+    // Tombstones count towards the load factor, rehashing removes them
+    hm.emplace(8, 8);
+    hm.emplace(9, 9);
+    EXPECT(hm.bucket_count() == 16);
+    EXPECT(hm.size() == 2);
+    for (int i = 10; i <= 15; ++i) {
+      hm.emplace(i, i);
+    }
+    EXPECT(hm.bucket_count() == 16);
+    EXPECT(hm.at(8) == 8);
+    EXPECT(hm.at(15) == 15);
+  }
+
+  {
+    // Randomized comparison against std::unordered_map
+    using alloc = std::allocator<std::pair<int, int>>;
+    HashMap<int, int, Hash, Equal, alloc, LinearProbing> linear(16, 0);
+    random_compare(linear);
+    HashMap<int, int, Hash, Equal, alloc, QuadraticProbing> quadratic(16, 0,
+                                                                      -1);
+    random_compare(quadratic);
+    HashMap<int, int, Hash, Equal, alloc, CacheLineProbing> cacheline(16, 0,
+                                                                      -1);
+    random_compare(cacheline);
+    HashMap<int, int, BadHash, Equal, alloc, QuadraticProbing> bad_quadratic(
+        16, 0, -1);
+    random_compare(bad_quadratic);
+    HashMap<int, int, BadHash, Equal, alloc, CacheLineProbing> bad_cacheline(
+        16, 0, -1);
+    random_compare(bad_cacheline);
+  }
+
+  // Max load factor
+  {
+    // Grows at 50% load by default
+    HashMap<uint32_t, uint32_t> hm(4, 0);
+    hm.emplace(1, 1);
+    hm.emplace(2, 2);
+    EXPECT(hm.bucket_count() == 4);
+    hm.emplace(3, 3);
+    EXPECT(hm.bucket_count() == 8);
+  }
+
+  {
+    // Grows at 75% load
+    using alloc = std::allocator<std::pair<uint32_t, uint32_t>>;
+    HashMap<uint32_t, uint32_t, std::hash<uint32_t>, std::equal_to<>, alloc,
+            LinearProbing, SweepClear, NoHooks, std::ratio<3, 4>>
+        hm(4, 0);
+    for (uint32_t i = 1; i <= 3; ++i) {
+      hm.emplace(i, i);
+    }
+    EXPECT(hm.bucket_count() == 4);
+    hm.emplace(4, 4);
+    EXPECT(hm.bucket_count() == 8);
+    hm.reserve(100);
+    EXPECT(hm.bucket_count() == 256);
+    hm.rehash(0);
+    EXPECT(hm.bucket_count() == 8);
+    EXPECT(hm.at(4) == 4);
+    EXPECT(hm.max_size() == hm.max_bucket_count() / 4 * 3);
+  }
+
+  {
+    // Randomized comparison against std::unordered_map at high load
+    using alloc = std::allocator<std::pair<int, int>>;
+    using dense = std::ratio<15, 16>;
+    HashMap<int, int, BadHash, Equal, alloc, LinearProbing, SweepClear,
+            NoHooks, dense>
+        linear(16, 0);
+    random_compare(linear);
+    HashMap<int, int, BadHash, Equal, alloc, QuadraticProbing, SweepClear,
+            NoHooks, dense>
+        quadratic(16, 0, -1);
+    random_compare(quadratic);
+  }
+
+  // Clear policies
+  {
+    auto test = [](auto &hm) {
+      // Clear repeatedly to wrap around the generation counter
+      for (int i = 0; i < 300; ++i) {
+        for (int j = 1; j <= 4; ++j) {
+          EXPECT(hm.emplace(j + i % 8, i).second);
+        }
+        EXPECT(hm.erase(1 + i % 8) == 1);
+        EXPECT(hm.size() == 3);
+        EXPECT(hm.at(2 + i % 8) == i);
+        EXPECT(std::distance(hm.begin(), hm.end()) == 3);
+        hm.clear();
+        EXPECT(hm.empty());
+        EXPECT(hm.begin() == hm.end());
+        for (int j = 1; j <= 12; ++j) {
+          EXPECT(hm.find(j) == hm.end());
+        }
+      }
+      // Fill beyond the tracking limit
+      for (int i = 1; i <= 100; ++i) {
+        hm.emplace(i, i);
+      }
+      EXPECT(hm.size() == 100);
+      hm.clear();
+      EXPECT(hm.empty());
+      EXPECT(hm.begin() == hm.end());
+      EXPECT(hm.emplace(1, 1).second);
+      EXPECT(hm.size() == 1);
+    };
+    using alloc = std::allocator<std::pair<int, int>>;
+    HashMap<int, int, Hash, Equal, alloc, LinearProbing, SweepClear> sweep(16,
+                                                                          0);
+    test(sweep);
+    HashMap<int, int, Hash, Equal, alloc, LinearProbing, GenerationClear<>>
+        generation(16, 0);
+    test(generation);
+    HashMap<int, int, BadHash, Equal, alloc, LinearProbing, GenerationClear<>>
+        bad_generation(16, 0);
+    test(bad_generation);
+    HashMap<int, int, BadHash, Equal, alloc, QuadraticProbing,
+            GenerationClear<>>
+        quadratic_generation(16, 0, -1);
+    test(quadratic_generation);
+    HashMap<int, int, Hash, Equal, alloc, LinearProbing, TrackedClear<8>>
+        tracked(16, 0);
+    test(tracked);
+    HashMap<int, int, BadHash, Equal, alloc, LinearProbing, TrackedClear<8>>
+        bad_tracked(16, 0);
+    test(bad_tracked);
+    // Copies track their own writes
+    auto tracked_copy = tracked;
+    EXPECT(tracked_copy.erase(1) == 1);
+    test(tracked_copy);
+    tracked = tracked_copy;
+    EXPECT(tracked.erase(1) == 1);
+    test(tracked);
+  }
+
+  {
+    // Randomized comparison against std::unordered_map
+    using alloc = std::allocator<std::pair<int, int>>;
+    HashMap<int, int, BadHash, Equal, alloc, LinearProbing, GenerationClear<>>
+        generation(16, 0);
+    random_compare(generation);
+    HashMap<int, int, BadHash, Equal, alloc, QuadraticProbing,
+            GenerationClear<>>
+        quadratic_generation(16, 0, -1);
+    random_compare(quadratic_generation);
+    HashMap<int, int, BadHash, Equal, alloc, LinearProbing, TrackedClear<8>>
+        tracked(16, 0);
+    random_compare(tracked);
+  }
+
+  {
+    // Hooks
+    using alloc = std::allocator<std::pair<int, int>>;
+    HashMap<int, int, BadHash, Equal, alloc, LinearProbing, SweepClear,
+            RecordingHooks>
+        hm(16, 0);
+    // Keys 4, 8, 12 and 16 collide with each other, a miss probes 5 buckets
+    for (int i = 1; i <= 4; ++i) {
+      hm.emplace(i * 4, i);
+    }
+    EXPECT(hm.hooks().long_probes == 0);
+    EXPECT(hm.find(20) == hm.end());
+    EXPECT(hm.hooks().long_probes == 1);
+    EXPECT(hm.hooks().probe_hash == 0);
+    EXPECT(hm.hooks().probe_length == 5);
+    EXPECT(hm.find(4) != hm.end());
+    EXPECT(hm.hooks().long_probes == 1);
+
+    // Erasing the first of 4 colliding keys scans 4 buckets, the first of 5
+    // scans 5 buckets
+    hm.erase(4);
+    EXPECT(hm.hooks().long_backshifts == 0);
+    hm.emplace(4, 1);
+    hm.emplace(20, 5);
+    hm.erase(8);
+    EXPECT(hm.hooks().long_backshifts == 1);
+    EXPECT(hm.hooks().backshift_hash == 0);
+    EXPECT(hm.hooks().backshift_length == 5);
+
+    // Hooks are kept across rehash
+    EXPECT(hm.hooks().rehash_begin == 0);
+    hm.rehash(64);
+    EXPECT(hm.hooks().rehash_begin == 1);
+    EXPECT(hm.hooks().rehash_end == 1);
+    EXPECT(hm.hooks().rehash_size == 4);
+    EXPECT(hm.hooks().rehash_bucket_count == 64);
+    EXPECT(hm.hooks().rehash_duration.count() >= 0);
+    EXPECT(hm.hooks().long_backshifts == 1);
+    for (int i = 100; i < 200; ++i) {
+      hm.emplace(i, i);
+    }
+    // Grows to 128 and 256 buckets
+    EXPECT(hm.hooks().rehash_begin == 3);
+    EXPECT(hm.hooks().rehash_end == 3);
+    EXPECT(hm.hooks().rehash_bucket_count == 256);
+    EXPECT(hm.hooks().long_probes > 1);
+  }
+
+  {
+    // Hooks are moved instead of copied when rehashing and merging, and see
+    // the long probes of reinserting items when rehashing
+    using alloc = std::allocator<std::pair<int, int>>;
+    using map = HashMap<int, int, BadHash, Equal, alloc, LinearProbing,
+                        SweepClear, CopyCountingHooks>;
+    map hm(16, 0);
+    for (int i = 1; i <= 5; ++i) {
+      hm.emplace(i * 4, i);
+    }
+    const int long_probes = hm.hooks().long_probes;
+    CopyCountingHooks::copies = 0;
+    hm.rehash(64);
+    EXPECT(hm.hooks().rehash_end == 1);
+    EXPECT(hm.hooks().long_probes == long_probes + 1);
+    map other(16, 0);
+    other.emplace(1, 1);
+    hm.merge(std::move(other), [](int &a, int &&b) { a += b; });
+    EXPECT(hm.size() == 6);
+    EXPECT(CopyCountingHooks::copies == 0);
+  }
+
   if (!ok) {
     fprintf(stderr, "FAILED!\n");
   }
@@ -0,0 +1,119 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <sstream>
+#include <string>
+
+#include <rigtorp/HashMap.h>
+#include <rigtorp/HashMapTrace.h>
+
+using namespace rigtorp;
+
+static bool ok = true;
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+    }                                                                          \
+    ok = ok && res;                                                            \
+  }(static_cast<bool>(expr)))
+#define THROWS(expr)                                                           \
+  ([&]() {                                                                     \
+    try {                                                                      \
+      expr;                                                                    \
+    } catch (...) {                                                            \
+      return true;                                                             \
+    }                                                                          \
+    return false;                                                              \
+  }())
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  // TraceWriter / TraceReader round trip
+  {
+    std::stringstream ss;
+    {
+      TraceWriter w(ss);
+      w.write(TraceEvent{TraceOp::find, 0, 0});
+      w.write(TraceEvent{TraceOp::insert, 127, 128});
+      w.write(TraceEvent{TraceOp::erase, ~uint64_t(0), 300});
+    }
+    // magic + (1 + 1 + 1) + (1 + 1 + 2) + (1 + 10 + 2)
+    EXPECT(ss.str().size() == 8 + 3 + 4 + 13);
+
+    TraceReader r(ss);
+    TraceEvent ev;
+    EXPECT(r.next(ev));
+    EXPECT(ev.op == TraceOp::find && ev.key == 0 && ev.delta_ns == 0);
+    EXPECT(r.next(ev));
+    EXPECT(ev.op == TraceOp::insert && ev.key == 127 && ev.delta_ns == 128);
+    EXPECT(r.next(ev));
+    EXPECT(ev.op == TraceOp::erase && ev.key == ~uint64_t(0) &&
+           ev.delta_ns == 300);
+    EXPECT(!r.next(ev));
+  }
+
+  {
+    // Invalid traces
+    std::stringstream bad_magic("HMTRACE0");
+    EXPECT(THROWS(TraceReader r(bad_magic)));
+
+    std::stringstream truncated(std::string("HMTRACE1") + '\x01' + '\x80');
+    TraceReader r(truncated);
+    TraceEvent ev;
+    EXPECT(THROWS(r.next(ev)));
+  }
+
+  // HashMapRecorder
+  {
+    HashMap<int, int> hm(16, 0);
+    std::stringstream ss;
+    {
+      HashMapRecorder<HashMap<int, int>> rec(hm, ss);
+      rec.insert({1, 1});
+      rec.emplace(2, 2);
+      rec[3] = 3;
+      EXPECT(rec.find(1) != rec.end());
+      EXPECT(rec.count(4) == 0);
+      EXPECT(rec.erase(2) == 1);
+      rec.erase(rec.find(3));
+      EXPECT(rec.size() == 1);
+    }
+    EXPECT(hm.size() == 1);
+    EXPECT(hm.at(1) == 1);
+
+    const TraceOp ops[] = {TraceOp::insert, TraceOp::insert, TraceOp::insert,
+                           TraceOp::find,   TraceOp::find,   TraceOp::erase,
+                           TraceOp::find,   TraceOp::erase};
+    const uint64_t keys[] = {1, 2, 3, 1, 4, 2, 3, 3};
+    TraceReader r(ss);
+    TraceEvent ev;
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+      EXPECT(r.next(ev));
+      EXPECT(ev.op == ops[i]);
+      EXPECT(ev.key == keys[i]);
+    }
+    EXPECT(!r.next(ev));
+  }
+
+  {
+    // Non-integral keys are recorded as their hash
+    HashMap<std::string, int> hm(16, "");
+    std::stringstream ss;
+    {
+      HashMapRecorder<HashMap<std::string, int>> rec(hm, ss);
+      rec.emplace(std::string("a"), 1);
+    }
+    TraceReader r(ss);
+    TraceEvent ev;
+    EXPECT(r.next(ev));
+    EXPECT(ev.key == std::hash<std::string>()("a"));
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
@@ -0,0 +1,113 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include <unordered_map>
+
+#include <rigtorp/HashMultiMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t keys = 100000;
+  size_t values = 8;
+  size_t iters = 10000000;
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "k:v:i:t:")) != -1) {
+    switch (opt) {
+    case 'k':
+      keys = std::stoul(optarg);
+      break;
+    case 'v':
+      values = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc) {
+  usage:
+    std::cerr << "HashMultiMapBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+                 "usage: HashMultiMapBenchmark [-k keys] [-v values per key] "
+                 "[-i iters] [-t 1|2]\n"
+              << std::endl;
+    exit(1);
+  }
+
+  using key = size_t;
+  using value = size_t;
+
+  struct hash {
+    size_t operator()(size_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  auto b = [&](const char *n, auto &m) {
+    std::minstd_rand gen(0);
+    std::uniform_int_distribution<key> ud(1, keys);
+
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < keys * values; ++i) {
+      m.emplace(ud(gen), i);
+    }
+    auto stop = steady_clock::now();
+    const auto build = duration_cast<nanoseconds>(stop - start);
+
+    // Lookup all values of a key
+    size_t sum = 0;
+    start = steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) {
+      const auto range = m.equal_range(ud(gen));
+      for (auto it = range.first; it != range.second; ++it) {
+        sum += it->second;
+      }
+    }
+    stop = steady_clock::now();
+    const auto lookup = duration_cast<nanoseconds>(stop - start);
+
+    // Replace one value of a key
+    start = steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) {
+      const key k = ud(gen);
+      const auto it = m.find(k);
+      if (it != m.end()) {
+        m.erase(it);
+      }
+      m.emplace(k, i);
+    }
+    stop = steady_clock::now();
+    const auto churn = duration_cast<nanoseconds>(stop - start);
+
+    std::cout << n << ": insert " << build.count() / (keys * values)
+              << " ns/iter, equal_range " << lookup.count() / iters
+              << " ns/iter, erase+insert " << churn.count() / iters
+              << " ns/iter (" << sum << ")" << std::endl;
+  };
+
+  if (type == -1 || type == 1) {
+    HashMultiMap<key, value, hash> hm(2 * keys * values, 0);
+    b("HashMultiMap", hm);
+  }
+
+  if (type == -1 || type == 2) {
+    std::unordered_multimap<key, value, hash> hm;
+    hm.reserve(keys * values);
+    b("std::unordered_multimap", hm);
+  }
+
+  return 0;
+}
@@ -0,0 +1,181 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <rigtorp/HashMultiMap.h>
+
+using namespace rigtorp;
+
+static bool ok = true;
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+    }                                                                          \
+    ok = ok && res;                                                            \
+  }(static_cast<bool>(expr)))
+
+struct Hash {
+  size_t operator()(int v) { return v * 7; }
+  size_t operator()(const std::string &v) { return std::stoi(v) * 7; }
+};
+
+struct Equal {
+  bool operator()(int lhs, int rhs) { return lhs == rhs; }
+  bool operator()(int lhs, const std::string &rhs) {
+    return lhs == std::stoi(rhs);
+  }
+};
+
+// Collides every key into the last buckets to exercise runs wrapping around
+// the end of the bucket array
+struct BadHash {
+  size_t operator()(int v) { return ~size_t(0) - (v & 1); }
+};
+
+template <typename M, typename K> std::vector<int> values(M &m, const K &key) {
+  std::vector<int> res;
+  auto range = m.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    res.push_back(it->second);
+  }
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  {
+    // insert(), emplace(), count()
+    HashMultiMap<int, int> hm(16, 0);
+    EXPECT(hm.empty());
+    auto it = hm.insert({1, 1});
+    EXPECT(it->first == 1);
+    EXPECT(it->second == 1);
+    it = hm.emplace(1, 2);
+    EXPECT(it->first == 1);
+    EXPECT(it->second == 2);
+    hm.emplace(2, 3);
+    EXPECT(hm.size() == 3);
+    EXPECT(hm.count(1) == 2);
+    EXPECT(hm.count(2) == 1);
+    EXPECT(hm.count(3) == 0);
+    EXPECT(values(hm, 1) == std::vector<int>({1, 2}));
+    EXPECT(values(hm, 2) == std::vector<int>({3}));
+    EXPECT(values(hm, 3).empty());
+    const auto &chm = hm;
+    EXPECT(values(chm, 1) == std::vector<int>({1, 2}));
+    EXPECT(chm.find(2) != chm.end());
+    EXPECT(chm.find(3) == chm.end());
+  }
+
+  {
+    // Heterogeneous lookup
+    HashMultiMap<int, int, Hash, Equal> hm(16, 0);
+    hm.emplace(1, 1);
+    hm.emplace(1, 2);
+    EXPECT(hm.count("1") == 2);
+    EXPECT(values(hm, "1") == std::vector<int>({1, 2}));
+    EXPECT(hm.find("1") != hm.end());
+    EXPECT(hm.erase("1") == 2);
+    EXPECT(hm.empty());
+  }
+
+  {
+    // erase(iterator) keeps the run contiguous
+    HashMultiMap<int, int> hm(16, 0);
+    for (int i = 0; i < 4; ++i) {
+      hm.emplace(1, i);
+    }
+    hm.erase(hm.find(1));
+    EXPECT(hm.count(1) == 3);
+    EXPECT(hm.size() == 3);
+    auto vals = values(hm, 1);
+    EXPECT(vals.size() == 3);
+    EXPECT(hm.erase(1) == 3);
+    EXPECT(hm.empty());
+    EXPECT(hm.begin() == hm.end());
+  }
+
+  {
+    // Runs wrapping around the end of the bucket array
+    HashMultiMap<int, int, BadHash> hm(16, 0);
+    for (int i = 1; i <= 6; ++i) {
+      hm.emplace(i & 1 ? 1 : 2, i);
+    }
+    EXPECT(hm.bucket_count() == 16);
+    EXPECT(values(hm, 1) == std::vector<int>({1, 3, 5}));
+    EXPECT(values(hm, 2) == std::vector<int>({2, 4, 6}));
+    hm.erase(hm.find(1));
+    EXPECT(hm.count(1) == 2);
+    EXPECT(hm.count(2) == 3);
+    EXPECT(hm.erase(2) == 3);
+    EXPECT(hm.count(1) == 2);
+    EXPECT(hm.size() == 2);
+  }
+
+  {
+    // Randomized comparison against std::multimap
+    HashMultiMap<int, int> hm(16, 0);
+    std::multimap<int, int> ref;
+    std::minstd_rand gen(0);
+    std::uniform_int_distribution<int> kd(1, 64);
+    for (int i = 0; i < 10000; ++i) {
+      const int key = kd(gen);
+      switch (gen() % 4) {
+      case 0:
+        EXPECT(hm.erase(key) == ref.erase(key));
+        break;
+      case 1: {
+        auto it = hm.find(key);
+        if (it != hm.end()) {
+          ref.erase(ref.find(key));
+          hm.erase(it);
+        }
+        break;
+      }
+      default:
+        hm.emplace(key, i);
+        ref.emplace(key, i);
+      }
+      EXPECT(hm.size() == ref.size());
+    }
+    for (int key = 1; key <= 64; ++key) {
+      EXPECT(hm.count(key) == ref.count(key));
+    }
+    size_t n = 0;
+    for (const auto &e : hm) {
+      EXPECT(ref.count(e.first) > 0);
+      n++;
+    }
+    EXPECT(n == ref.size());
+  }
+
+  {
+    // rehash(), clear()
+    HashMultiMap<int, int> hm(2, 0);
+    for (int i = 0; i < 10; ++i) {
+      hm.emplace(i % 3 + 1, i);
+    }
+    EXPECT(hm.bucket_count() == 32);
+    EXPECT(hm.count(1) == 4);
+    EXPECT(hm.count(2) == 3);
+    EXPECT(hm.count(3) == 3);
+    hm.clear();
+    EXPECT(hm.empty());
+    EXPECT(hm.count(1) == 0);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
@@ -0,0 +1,174 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <rigtorp/OrderedIndex.h>
+
+using namespace rigtorp;
+
+static bool ok = true;
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+    }                                                                          \
+    ok = ok && res;                                                            \
+  }(static_cast<bool>(expr)))
+
+template <typename Probe = LinearProbing>
+using Map = HashMap<int, int, std::hash<int>, std::equal_to<void>,
+                    std::allocator<std::pair<int, int>>, Probe, SweepClear,
+                    OrderedIndex<int>>;
+
+// Counts calls to hash keys
+struct CountingHash {
+  size_t operator()(int key) const noexcept {
+    calls++;
+    return std::hash<int>()(key);
+  }
+  static int calls;
+};
+
+int CountingHash::calls = 0;
+
+// Returns true if hm.range(lo, hi) matches ref
+template <typename M>
+static bool same_range(M &hm, const std::map<int, int> &ref, int lo, int hi) {
+  auto r = hm.range(lo, hi);
+  auto it = ref.lower_bound(lo);
+  const auto last = ref.lower_bound(hi);
+  size_t n = 0;
+  for (auto &e : r) {
+    if (it == last || e.first != it->first || e.second != it->second) {
+      return false;
+    }
+    ++it;
+    ++n;
+  }
+  return it == last && n == r.size();
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  {
+    Map<> hm(16, 0);
+    EXPECT(hm.range(0, 100).empty());
+    for (int i : {5, 3, 9, 1, 7}) {
+      hm.emplace(i, i * 10);
+    }
+    EXPECT(hm.hooks().pending() == 5);
+    auto r = hm.range(3, 9);
+    EXPECT(hm.hooks().pending() == 0);
+    EXPECT(r.size() == 3);
+    std::vector<int> keys;
+    for (const auto &e : r) {
+      keys.push_back(e.first);
+    }
+    EXPECT(keys == std::vector<int>({3, 5, 7}));
+    // Values aren't copied
+    EXPECT(&*r.begin() == &*hm.find(3));
+    r.begin()->second = 30;
+    EXPECT(hm.at(3) == 30);
+
+    // Existing keys aren't logged, erased keys are
+    hm.emplace(5, 0);
+    hm[3] = 3;
+    EXPECT(hm.hooks().pending() == 0);
+    hm.erase(5);
+    hm.erase(5);
+    hm.emplace(6, 60);
+    EXPECT(hm.hooks().pending() == 2);
+    keys.clear();
+    for (const auto &e : hm.range(0, 100)) {
+      keys.push_back(e.first);
+    }
+    EXPECT(keys == std::vector<int>({1, 3, 6, 7, 9}));
+
+    // Rehashing doesn't change the index
+    hm.rehash(1024);
+    EXPECT(hm.hooks().pending() == 0);
+    EXPECT(hm.range(0, 100).size() == 5);
+
+    hm.clear();
+    EXPECT(hm.range(0, 100).empty());
+    hm.emplace(2, 2);
+    EXPECT(hm.range(0, 100).size() == 1);
+  }
+
+  {
+    // Each item is found once per advance of the iterator
+    HashMap<int, int, CountingHash, std::equal_to<void>,
+            std::allocator<std::pair<int, int>>, LinearProbing, SweepClear,
+            OrderedIndex<int>>
+        hm(16, 0);
+    for (int i = 1; i <= 5; ++i) {
+      hm.emplace(i, i);
+    }
+    auto r = hm.range(0, 100);
+    CountingHash::calls = 0;
+    int sum = 0;
+    for (auto it = r.begin(); it != r.end(); it++) {
+      sum += it->first + (*it).second;
+    }
+    EXPECT(sum == 30);
+    EXPECT(CountingHash::calls == 5);
+  }
+
+  {
+    // Randomized comparison against std::map, including tombstones and
+    // rebuilding the index from the map when the log grows large
+    auto test = [](auto &hm) {
+      std::map<int, int> ref;
+      std::minstd_rand gen(0);
+      for (int round = 0; round < 20; ++round) {
+        const int ops = round % 4 == 0 ? 5000 : 100;
+        for (int i = 0; i < ops; ++i) {
+          const int key = 1 + gen() % 2000;
+          if (gen() % 3 == 0) {
+            EXPECT(hm.erase(key) == ref.erase(key));
+          } else {
+            EXPECT(hm.emplace(key, i).second == ref.emplace(key, i).second);
+          }
+        }
+        const int lo = gen() % 2000;
+        EXPECT(same_range(hm, ref, lo, lo + gen() % 500));
+        EXPECT(same_range(hm, ref, 0, 3000));
+      }
+    };
+    Map<> linear(16, 0);
+    test(linear);
+    Map<QuadraticProbing> quadratic(16, 0, -1);
+    test(quadratic);
+  }
+
+  {
+    // Merging and deserializing insert into the index
+    Map<> a(16, 0);
+    Map<> b(16, 0);
+    a.emplace(1, 1);
+    b.emplace(2, 2);
+    b.emplace(1, 1);
+    a.merge(std::move(b), [](int &x, int y) { x += y; });
+    EXPECT(a.range(0, 10).size() == 2);
+    EXPECT(a.range(1, 2).begin()->second == 2);
+    EXPECT(b.range(0, 10).empty());
+
+    std::stringstream ss;
+    a.serialize(ss);
+    Map<> c(16, 0);
+    c.deserialize(ss);
+    EXPECT(c.range(0, 10).size() == 2);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
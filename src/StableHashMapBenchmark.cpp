@@ -0,0 +1,107 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <nmmintrin.h> // _mm_crc32_u64
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+#include <rigtorp/HashMap.h>
+#include <rigtorp/StableHashMap.h>
+
+using namespace std::chrono;
+using namespace rigtorp;
+
+int main(int argc, char *argv[]) {
+  size_t count = 1000000;
+  size_t iters = 10000000;
+  int type = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:i:t:")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = std::stoul(optarg);
+      break;
+    case 'i':
+      iters = std::stoul(optarg);
+      break;
+    case 't':
+      type = std::stoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (optind != argc || count == 0) {
+  usage:
+    std::cerr
+        << "StableHashMapBenchmark © 2020 Erik Rigtorp <erik@rigtorp.se>\n"
+           "usage: StableHashMapBenchmark [-c count] [-i iters] [-t 1|2]\n"
+        << std::endl;
+    exit(1);
+  }
+
+  using key = uint64_t;
+  struct value {
+    char buf[24];
+  };
+
+  struct hash {
+    size_t operator()(uint64_t h) const noexcept { return _mm_crc32_u64(0, h); }
+  };
+
+  // Draw lookups up front, half hits and half misses
+  std::vector<key> lookups(iters);
+  {
+    std::minstd_rand gen(0);
+    std::uniform_int_distribution<key> ud(1, 2 * count);
+    for (auto &k : lookups) {
+      k = ud(gen);
+    }
+  }
+
+  auto b = [&](const char *n, auto &m, size_t bytes, auto &&find) {
+    size_t hits = 0;
+    auto start = steady_clock::now();
+    for (const auto k : lookups) {
+      hits += find(k);
+    }
+    auto stop = steady_clock::now();
+    auto duration = duration_cast<nanoseconds>(stop - start);
+    std::cout << n << ": " << duration.count() / iters << " ns/lookup, "
+              << static_cast<double>(bytes) / m.size() << " bytes/item ("
+              << hits << " hits)" << std::endl;
+  };
+
+  if (type == -1 || type == 1) {
+    HashMap<key, value, hash> hm(16, 0);
+    for (key k = 1; k <= count; ++k) {
+      hm.emplace(k, value{});
+    }
+    b("HashMap", hm,
+      hm.bucket_count() * sizeof(decltype(hm)::value_type),
+      [&](key k) { return hm.find(k) != hm.end(); });
+  }
+
+  if (type == -1 || type == 2) {
+    StableHashMap<key, value, hash> hm(16, 0);
+    for (key k = 1; k <= count; ++k) {
+      hm.emplace(k, value{});
+    }
+    b("StableHashMap", hm,
+      hm.bucket_count() * sizeof(std::pair<key, uint32_t>) +
+          hm.slab_size() * sizeof(value),
+      [&](key k) {
+        // Touch the value to include the indirection
+        auto p = hm.find(k);
+        return p != nullptr && p->buf[0] == 0;
+      });
+  }
+
+  return 0;
+}
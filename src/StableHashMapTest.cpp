@@ -0,0 +1,192 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <rigtorp/StableHashMap.h>
+
+using namespace rigtorp;
+
+static bool ok = true;
+
+#define EXPECT(expr)                                                           \
+  ([](bool res) {                                                              \
+    if (!res) {                                                                \
+      fprintf(stdout, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #expr);        \
+    }                                                                          \
+    ok = ok && res;                                                            \
+  }(static_cast<bool>(expr)))
+#define THROWS(expr)                                                           \
+  ([&]() {                                                                     \
+    try {                                                                      \
+      expr;                                                                    \
+    } catch (...) {                                                            \
+      return true;                                                             \
+    }                                                                          \
+    return false;                                                              \
+  }())
+
+struct Hash {
+  size_t operator()(int v) { return v * 7; }
+  size_t operator()(const std::string &v) { return std::stoi(v) * 7; }
+};
+
+struct Equal {
+  bool operator()(int lhs, int rhs) { return lhs == rhs; }
+  bool operator()(int lhs, const std::string &rhs) {
+    return lhs == std::stoi(rhs);
+  }
+};
+
+// Counts live instances to check that destructors are called
+struct Counted {
+  static int live;
+  explicit Counted(int v = 0) : value(v) {
+    if (v < 0) {
+      throw std::runtime_error("negative");
+    }
+    live++;
+  }
+  Counted(const Counted &other) : value(other.value) { live++; }
+  ~Counted() { live--; }
+  int value;
+};
+int Counted::live = 0;
+
+int main(int argc, char *argv[]) {
+  (void)argc, (void)argv;
+
+  {
+    // insert(), emplace(), find(), at(), operator[], count(), erase()
+    StableHashMap<int, int> hm(16, 0);
+    EXPECT(hm.empty());
+    auto res = hm.insert({1, 1});
+    EXPECT(res.second);
+    EXPECT(*res.first == 1);
+    res = hm.emplace(1, 2);
+    EXPECT(!res.second);
+    EXPECT(*res.first == 1);
+    EXPECT(hm.try_emplace(2, 2).second);
+    hm[3] = 3;
+    EXPECT(hm.size() == 3);
+    EXPECT(hm.find(1) != nullptr && *hm.find(1) == 1);
+    EXPECT(hm.find(4) == nullptr);
+    EXPECT(hm.at(3) == 3);
+    EXPECT(THROWS(hm.at(4)));
+    EXPECT(hm.count(2) == 1);
+    EXPECT(hm.erase(2) == 1);
+    EXPECT(hm.erase(2) == 0);
+    EXPECT(hm.count(2) == 0);
+    EXPECT(hm.size() == 2);
+    const auto &chm = hm;
+    EXPECT(chm.find(1) != nullptr);
+    EXPECT(chm.at(1) == 1);
+    int sum = 0;
+    chm.for_each([&](int k, const int &v) { sum += k + v; });
+    EXPECT(sum == 8);
+  }
+
+  {
+    // Heterogeneous lookup
+    StableHashMap<int, int, Hash, Equal> hm(16, 0);
+    hm[1] = 1;
+    EXPECT(hm.find("1") != nullptr);
+    EXPECT(hm.count("2") == 0);
+    EXPECT(hm.erase("1") == 1);
+    EXPECT(hm.empty());
+  }
+
+  {
+    // Pointers stay valid across rehash and erase of other keys
+    StableHashMap<int, int> hm(2, 0);
+    int *p = hm.emplace(1, 42).first;
+    std::map<int, int *> ptrs;
+    for (int i = 2; i <= 5000; ++i) {
+      ptrs[i] = hm.emplace(i, i).first;
+    }
+    EXPECT(hm.bucket_count() > 2);
+    for (int i = 2; i <= 5000; i += 2) {
+      hm.erase(i);
+    }
+    EXPECT(*p == 42);
+    EXPECT(hm.find(1) == p);
+    bool valid = true;
+    for (int i = 3; i <= 5000; i += 2) {
+      valid = valid && hm.find(i) == ptrs[i] && *ptrs[i] == i;
+    }
+    EXPECT(valid);
+    // Erased slots are reused
+    const size_t slab = hm.slab_size();
+    for (int i = 2; i <= 5000; i += 2) {
+      hm.emplace(i, i);
+    }
+    EXPECT(hm.slab_size() == slab);
+    EXPECT(hm.size() == 5000);
+  }
+
+  {
+    // Destructors are called on erase, clear and destruction
+    {
+      StableHashMap<int, Counted> hm(16, 0);
+      for (int i = 1; i <= 100; ++i) {
+        hm.emplace(i, i);
+      }
+      EXPECT(Counted::live == 100);
+      hm.erase(1);
+      EXPECT(Counted::live == 99);
+      hm.clear();
+      EXPECT(Counted::live == 0);
+      EXPECT(hm.empty());
+      for (int i = 1; i <= 10; ++i) {
+        hm.emplace(i, i);
+      }
+      // A throwing constructor leaves the map unchanged
+      EXPECT(THROWS(hm.emplace(11, -1)));
+      EXPECT(hm.count(11) == 0);
+      EXPECT(hm.size() == 10);
+      EXPECT(Counted::live == 10);
+    }
+    EXPECT(Counted::live == 0);
+  }
+
+  {
+    // Move only values
+    StableHashMap<int, std::unique_ptr<int>> hm(16, 0);
+    hm.emplace(1, std::unique_ptr<int>(new int(1)));
+    hm[2] = std::unique_ptr<int>(new int(2));
+    EXPECT(**hm.find(1) == 1);
+    EXPECT(*hm.at(2) == 2);
+  }
+
+  {
+    // Randomized comparison against std::map
+    StableHashMap<int, int> hm(16, 0);
+    std::map<int, int> ref;
+    std::minstd_rand gen(0);
+    std::uniform_int_distribution<int> kd(1, 512);
+    for (int i = 0; i < 100000; ++i) {
+      const int key = kd(gen);
+      if (gen() % 2) {
+        EXPECT(hm.erase(key) == ref.erase(key));
+      } else {
+        EXPECT(hm.emplace(key, i).second == ref.emplace(key, i).second);
+      }
+    }
+    EXPECT(hm.size() == ref.size());
+    bool equal = true;
+    for (const auto &e : ref) {
+      equal = equal && hm.find(e.first) && *hm.find(e.first) == e.second;
+    }
+    EXPECT(equal);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "FAILED!\n");
+  }
+  return !ok;
+}
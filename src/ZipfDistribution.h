@@ -0,0 +1,40 @@
+// © 2017-2020 Erik Rigtorp <erik@rigtorp.se>
+// SPDX-License-Identifier: MIT
+
+// Zipfian distribution over [1, n] used by the benchmarks to model skewed key
+// access. Samples by binary search over a precomputed CDF, so benchmarks
+// should draw their keys before starting the clock.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+template <typename IntType = size_t> class zipf_distribution {
+public:
+  using result_type = IntType;
+
+  zipf_distribution(result_type n, double s = 1.0) : cdf_(n) {
+    double sum = 0;
+    for (result_type i = 0; i < n; ++i) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+      cdf_[i] = sum;
+    }
+    for (auto &c : cdf_) {
+      c /= sum;
+    }
+  }
+
+  template <typename Generator> result_type operator()(Generator &g) {
+    const double u = std::uniform_real_distribution<double>(0, 1)(g);
+    const auto it = std::lower_bound(cdf_.begin(), cdf_.end(), u);
+    return static_cast<result_type>(
+        std::min<size_t>(it - cdf_.begin(), cdf_.size() - 1) + 1);
+  }
+
+private:
+  std::vector<double> cdf_;
+};